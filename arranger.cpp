@@ -1,13 +1,23 @@
 #include "arranger.h"
+#include <QComboBox>
+#include <QDoubleSpinBox>
 #include <QFormLayout>
 #include <QGraphicsScene>
-#include <QPainter>
-#include <QPixmap>
+#include <QQueue>
+#include <QSpinBox>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include "compositor.h"
+#include "layoutstate.h"
+#include "pointgrid.h"
+#include "runcontrol.h"
 #include "segment.h"
 #include "segmentlist.h"
+#include "stats.h"
+#include "trace.h"
 
 Arranger::Arranger(QString const & name) :
-   name(name), settingsLayout(new QFormLayout())
+   name(name), settingsLayout(nullptr), artifacts(nullptr), control(nullptr)
 {
 }
 
@@ -15,6 +25,31 @@ Arranger::~Arranger() {
    delete settingsLayout;
 }
 
+void Arranger::beginStage(QString const & stage, int maximum) const {
+   // the progress stages are also where the memory of a run is sampled
+   TIDY_STAGE(stage);
+   if (control) {
+      control->setStage(stage, maximum);
+   }
+}
+
+bool Arranger::canceled() const {
+   return control && control->isCanceled();
+}
+
+QGraphicsScene * Arranger::createScene(Arrangement const & arrangement) {
+   // pixmaps are involved, so this has to run in the gui thread
+   QGraphicsScene * scene = new QGraphicsScene();
+   scene->setBackgroundBrush(QBrush(QColor(arrangement.background)));
+   LayoutState const & layout = arrangement.layout;
+   for (int i=0; i<layout.size(); ++i) {
+      scene->addItem(layout.segment(i)->toQGraphicsItem(layout.placement(i)));
+      // without the following line QPainter tends to crash
+      scene->width();
+   }
+   return scene;
+}
+
 Segment * Arranger::determineBackground(SegmentList const & segments) const {
    // determin background according to neighbor count and area
    Segment * backgroundNeighbors = nullptr;
@@ -68,22 +103,100 @@ Segment * Arranger::determineBackground(SegmentList const & segments) const {
    }
 }
 
+QVector<Contact> Arranger::findCollisions(LayoutState const & layout,
+                                          BroadPhase & broadPhase) const {
+   broadPhase.update();
+   QVector<IndexPair> const & pairs = broadPhase.candidatePairs();
+
+   // split the candidates into blocks of fixed size (independent of the thread count)
+   int const blockSize = 64;
+   QList<CollisionData> collisionData;
+   for (int begin=0; begin<pairs.size(); begin+=blockSize) {
+      collisionData << CollisionData{layout, pairs,
+                                     begin, std::min(begin+blockSize, pairs.size())};
+   }
+
+   // test the blocks in parallel and concatenate the results in block order
+   QVector<Contact> collisions;
+   foreach (QVector<Contact> const & block, QtConcurrent::blockingMapped(collisionData, collideMT)) {
+      collisions << block;
+   }
+   // every candidate is tested exactly once
+   TIDY_COUNT(CollidesCalls, pairs.size());
+   TIDY_COUNT(Collisions, collisions.size());
+   return collisions;
+}
+
+void Arranger::forgetSegments() {
+   // only arrangers that keep layouts between runs have something to drop
+}
+
 QString Arranger::getName() const {
    return name;
 }
 
-QLayout * Arranger::getSettingsLayout() const {
+QLayout * Arranger::getSettingsLayout() {
+   // the widgets are only created for the gui, they just edit the parameters
+   if (!settingsLayout) {
+      settingsLayout = new QFormLayout();
+      populateSettingsLayout();
+   }
    return settingsLayout;
 }
 
-void Arranger::initializeLayout(SegmentList & segments, int featX, int featY) const {
-   double const edgelength = sqrt(segments.area()<<2);
-   foreach (Segment * const segment, segments) {
-      segment->setPosition(Position(segment->features()[featX] * edgelength,
-                                    segment->features()[featY] * edgelength));
+void Arranger::initializeLayout(LayoutState & layout, int featX, int featY) const {
+   double const edgelength = sqrt(layout.area()<<2);
+   for (int i=0; i<layout.size(); ++i) {
+      layout.setPosition(i, Position(layout.segment(i)->features()[featX] * edgelength,
+                                     layout.segment(i)->features()[featY] * edgelength));
    }
 }
 
+void Arranger::populateAxisSettings(ArrangerParameters & params) {
+   QComboBox * xAxisBox = new QComboBox();
+   for (int i=0; i<10; ++i) {
+      xAxisBox->insertItem(i, FeatureVector::toString(i));
+   }
+   xAxisBox->setCurrentIndex(params.xAxis);
+   QObject::connect(xAxisBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                    [&params](int index) { params.xAxis = index; });
+   settingsLayout->addRow(QObject::tr("x axis"), xAxisBox);
+
+   QComboBox * yAxisBox = new QComboBox();
+   for (int i=0; i<10; ++i) {
+      yAxisBox->insertItem(i, FeatureVector::toString(i));
+   }
+   yAxisBox->setCurrentIndex(params.yAxis);
+   QObject::connect(yAxisBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                    [&params](int index) { params.yAxis = index; });
+   settingsLayout->addRow(QObject::tr("y axis"), yAxisBox);
+}
+
+void Arranger::populateBudgetSettings(ArrangerParameters & params) {
+   QSpinBox * maxIterationsBox = new QSpinBox();
+   maxIterationsBox->setRange(0, 1000000);
+   maxIterationsBox->setValue(params.maxIterations);
+   maxIterationsBox->setSpecialValueText(QObject::tr("unlimited"));
+   maxIterationsBox->setToolTip(QObject::tr("The maximum number of iterations of each refinement loop"));
+   QObject::connect(maxIterationsBox, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+                    [&params](int value) { params.maxIterations = value; });
+   settingsLayout->addRow(QObject::tr("Iteration limit"), maxIterationsBox);
+
+   QDoubleSpinBox * maxSecondsBox = new QDoubleSpinBox();
+   maxSecondsBox->setRange(0.0, 3600.0);
+   maxSecondsBox->setValue(params.maxSeconds);
+   maxSecondsBox->setSuffix(" s");
+   maxSecondsBox->setSpecialValueText(QObject::tr("unlimited"));
+   maxSecondsBox->setToolTip(QObject::tr("The maximum time spent on one arrangement (the best layout found so far is used)"));
+   QObject::connect(maxSecondsBox, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+                    [&params](double value) { params.maxSeconds = value; });
+   settingsLayout->addRow(QObject::tr("Time limit"), maxSecondsBox);
+}
+
+RefineBudget Arranger::refineBudget(ArrangerParameters const & params) const {
+   return RefineBudget(params.maxIterations, params.maxSeconds, control);
+}
+
 SegmentList Arranger::removeBackground(SegmentList const & segments,
                                        Segment * const background) const {
    SegmentList remain;
@@ -97,11 +210,204 @@ SegmentList Arranger::removeBackground(SegmentList const & segments,
    return remain;
 }
 
-void Arranger::saveScene(QGraphicsScene * const scene, QString const & filename) const {
-   QPixmap pixmap(scene->sceneRect().size().toSize());
+void Arranger::saveLayout(LayoutState const & layout, QRgb background, QString const & filename,
+                          ArtifactSink::Level level) const {
+   // the sink encodes and writes the image elsewhere, so compositing is all that is done here
+   if (artifacts && artifacts->accepts(level)) {
+      artifacts->write(level, Compositor(layout).render(background), filename);
+   }
+}
 
-   QPainter painter(&pixmap);
-   scene->render(&painter);
+int Arranger::separateCircles(LayoutState & layout, RefineBudget const & budget) const {
+   // approximate every segment by a circle of the same (scaled) area
+   int const count = layout.size();
+   QVector<double> radii(count);
+   double maxRadius = 0.5;
+   for (int i=0; i<count; ++i) {
+      radii[i] = sqrt(layout.segment(i)->area() / 3.14159265) * layout.scale(i);
+      maxRadius = std::max(maxRadius, radii.at(i));
+   }
 
-   pixmap.save(filename);
+   // push overlapping circles apart until they are (almost) disjoint
+   QVector<Position> positions = layout.positions();
+   QVector<Position> corrections(count);
+   int const maxPass = 200;
+   int pass = 0;
+   int overlaps;
+   Position delta;
+   double dist, overlap;
+   do {
+      overlaps = 0;
+      corrections.fill(Position());
+      PointGrid grid(positions, 2.0*maxRadius);
+      for (int i=0; i<count; ++i) {
+         foreach (int const j, grid.within(positions.at(i), pow(radii.at(i) + maxRadius, 2.0))) {
+            if (j <= i) continue;
+            delta = positions.at(i) - positions.at(j);
+            dist = delta.magnitude();
+            overlap = radii.at(i) + radii.at(j) - dist;
+            if (overlap > 0.0) {
+               ++overlaps;
+               // coincident centers are separated horizontally
+               delta = dist > 0.0 ? delta / dist : Position(1.0, 0.0);
+               corrections[i] += delta * (overlap*0.5);
+               corrections[j] -= delta * (overlap*0.5);
+            }
+         }
+      }
+      for (int i=0; i<count; ++i) {
+         positions[i] += corrections.at(i);
+      }
+      ++pass;
+   } while (overlaps > 0 && pass < maxPass && !budget.exhausted(0));
+   TIDY_COUNT(CirclePasses, pass);
+
+   for (int i=0; i<count; ++i) {
+      layout.setPosition(i, positions.at(i));
+   }
+   return overlaps;
+}
+
+bool Arranger::setArrangerParameter(ArrangerParameters & params, QString const & key, QString const & value) const {
+   // the axes are given by feature name or index
+   if (key == "xAxis" || key == "yAxis") {
+      bool ok;
+      int axis = value.toInt(&ok);
+      if (!ok) {
+         axis = -1;
+         for (int i=0; i<10; ++i) {
+            if (FeatureVector::toString(i).compare(value, Qt::CaseInsensitive) == 0) {
+               axis = i;
+            }
+         }
+      }
+      if (axis < 0 || axis >= 10) {
+         return false;
+      }
+      if (key == "xAxis") {
+         params.xAxis = axis;
+      }
+      else {
+         params.yAxis = axis;
+      }
+      return true;
+   }
+
+   // same ranges as the settings widgets
+   bool ok;
+   double const number = value.toDouble(&ok);
+   if (!ok) {
+      return false;
+   }
+   if (key == "maxIterations") {
+      params.maxIterations = qBound(0, qRound(number), 1000000);
+   }
+   else if (key == "maxSeconds") {
+      params.maxSeconds = qBound(0.0, number, 3600.0);
+   }
+   else {
+      return false;
+   }
+   return true;
+}
+
+void Arranger::setArtifactSink(ArtifactSink * sink) {
+   artifacts = sink;
+}
+
+void Arranger::setRunControl(RunControl * control) {
+   this->control = control;
+}
+
+void Arranger::sweepFeaturePairs(std::function<BatchResult(int, int, BatchResult const *)> const & arrangePair,
+                                 std::function<void(BatchResult const &)> const & finishPair,
+                                 bool chained) const {
+   // one job per pair, or per x axis if each pair builds on its predecessor
+   QList<QList<IndexPair>> jobs;
+   int pairCount = 0;
+   for (int i=0; i<9; ++i) {
+      for (int j=i+1; j<10; ++j) {
+         if (!chained || j == i+1) {
+            jobs << QList<IndexPair>();
+         }
+         jobs.last() << IndexPair(i, j);
+         ++pairCount;
+      }
+   }
+
+   // arrange the jobs in the background, at most one per thread is in flight
+   // to bound the memory, and finish them in order on the calling thread
+   int const maxInFlight = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+   QQueue<QFuture<BatchResults>> inFlight;
+   auto finishJob = [this, &finishPair, &inFlight]() {
+      foreach (BatchResult const & result, inFlight.head().result()) {
+         finishPair(result);
+         if (control) {
+            control->advance();
+         }
+      }
+      inFlight.dequeue();
+   };
+   beginStage(QObject::tr("Arranging feature pairs"), pairCount);
+#ifdef TIDY_STATS
+   Stats * const stats = Stats::current();
+#endif
+   foreach (QList<IndexPair> const & pairs, jobs) {
+      if (canceled()) {
+         break;
+      }
+      if (inFlight.size() >= maxInFlight) {
+         finishJob();
+      }
+      inFlight.enqueue(QtConcurrent::run([arrangePair, pairs
+#ifdef TIDY_STATS
+                                          , stats
+#endif
+                                         ]() {
+#ifdef TIDY_STATS
+         StatsScope const scope(stats);
+#endif
+         BatchResults results;
+         foreach (IndexPair const & pair, pairs) {
+            TraceSpan const span("Arranger::arrangePair");
+            results << arrangePair(pair.first, pair.second, results.isEmpty() ? nullptr : &results.last());
+         }
+         return results;
+      }));
+   }
+   while (!inFlight.isEmpty()) {
+      finishJob();
+   }
+}
+
+void Arranger::warmStartLayout(LayoutState & layout, int fromX, int fromY, int toX, int toY) const {
+   // keep the offsets the previous refinement found and only move along the changed axes
+   double const edgelength = sqrt(layout.area()<<2);
+   for (int i=0; i<layout.size(); ++i) {
+      FeatureVector const & features = layout.segment(i)->features();
+      layout.translate(i, Position((features[toX] - features[fromX]) * edgelength,
+                                   (features[toY] - features[fromY]) * edgelength));
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+QVector<Contact> collideMT(CollisionData const & data) {
+   QVector<Contact> collisions;
+   int a, b;
+   Position normal;
+   double depth;
+   for (int p=data.begin; p<data.end; ++p) {
+      a = data.pairs.at(p).first;
+      b = data.pairs.at(p).second;
+      Placement const placementA = data.layout.placement(a);
+      Placement const placementB = data.layout.placement(b);
+      if (data.layout.segment(a)->collides(placementA, data.layout.segment(b), placementB)) {
+         // separate along the centroids if the probes miss the overlap
+         normal = (placementA.pos - placementB.pos).normalized();
+         depth = data.layout.segment(a)->penetration(placementA, data.layout.segment(b), placementB, normal);
+         collisions << Contact{a, b, normal, depth};
+      }
+   }
+   return collisions;
 }
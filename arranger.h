@@ -1,33 +1,106 @@
 #ifndef ARRANGER_H
 #define ARRANGER_H
 
+#include <functional>
+#include <QList>
+#include <QColor>
+#include <QImage>
 #include <QString>
+#include "artifactsink.h"
+#include "broadphase.h"
+#include "layoutintegrator.h"
+#include "layoutstate.h"
+#include "pixel.h"
 
 class QFormLayout;
 class QGraphicsScene;
 class QLayout;
+class RunControl;
 class Segment;
 class SegmentList;
 
+struct Contact {
+   int first;
+   int second;
+   Position normal;
+   double depth;
+};
+
+struct BatchResult {
+   int featX;
+   int featY;
+   QString log;
+   QList<LayoutState> layouts;
+   // collisions (or unplaced segments) left in the first layout
+   int residual;
+};
+
+using BatchResults = QList<BatchResult>;
+
+struct Arrangement {
+   LayoutState layout;
+   QRgb background;
+};
+
+struct ArrangerParameters {
+   int xAxis = 0;
+   int yAxis = 1;
+   int maxIterations = 5000;
+   double maxSeconds = 0.0;
+};
+
 class Arranger {
 
 public:
    explicit Arranger(QString const & name);
    virtual ~Arranger();
-   virtual QGraphicsScene * arrange(SegmentList const & segments) const = 0;
+   virtual Arrangement arrange(SegmentList const & segments) const = 0;
    virtual void arrangeBatch(SegmentList const & segments, QString const & name) const = 0;
+   virtual bool setParameter(QString const & key, QString const & value) = 0;
+   virtual void forgetSegments();
    QString getName() const;
-   QLayout * getSettingsLayout() const;
+   QLayout * getSettingsLayout();
+   void setArtifactSink(ArtifactSink * sink);
+   void setRunControl(RunControl * control);
+
+   static QGraphicsScene * createScene(Arrangement const & arrangement);
 
 protected:
    QString name;
    QFormLayout * settingsLayout;
+   ArtifactSink * artifacts;
+   RunControl * control;
+
+   virtual void populateSettingsLayout() = 0;
 
+   void beginStage(QString const & stage, int maximum = 0) const;
+   bool canceled() const;
    Segment * determineBackground(SegmentList const & segments) const;
+   QVector<Contact> findCollisions(LayoutState const & layout,
+                                   BroadPhase & broadPhase) const;
    SegmentList removeBackground(SegmentList const & segments,
                                 Segment * const background) const;
-   void initializeLayout(SegmentList & segments, int featX, int featY) const;
-   void saveScene(QGraphicsScene * const scene, QString const & filename) const;
+   void initializeLayout(LayoutState & layout, int featX, int featY) const;
+   void populateAxisSettings(ArrangerParameters & params);
+   void populateBudgetSettings(ArrangerParameters & params);
+   RefineBudget refineBudget(ArrangerParameters const & params) const;
+   void saveLayout(LayoutState const & layout, QRgb background, QString const & filename,
+                   ArtifactSink::Level level = ArtifactSink::Results) const;
+   int separateCircles(LayoutState & layout, RefineBudget const & budget) const;
+   bool setArrangerParameter(ArrangerParameters & params, QString const & key, QString const & value) const;
+   void sweepFeaturePairs(std::function<BatchResult(int, int, BatchResult const *)> const & arrangePair,
+                          std::function<void(BatchResult const &)> const & finishPair,
+                          bool chained = false) const;
+   void warmStartLayout(LayoutState & layout, int fromX, int fromY, int toX, int toY) const;
 };
 
+struct CollisionData {
+   LayoutState const & layout;
+   QVector<IndexPair> const & pairs;
+   int begin;
+   int end;
+};
+
+QVector<Contact> collideMT(CollisionData const & data);
+
 #endif // ARRANGER_H
@@ -0,0 +1,183 @@
+#include "artifactsink.h"
+#include <cstring>
+#include <QFile>
+#include <QFileInfo>
+#include <QSharedPointer>
+#include <QtConcurrent>
+#include "trace.h"
+
+ArtifactSink::ArtifactSink(Level level, Format format, int capacity) :
+   level(level), format(format), freeSlots(std::max(1, capacity))
+{
+   encoders.setMaxThreadCount(2);
+}
+
+ArtifactSink::~ArtifactSink() {
+   encoders.waitForDone();
+}
+
+bool ArtifactSink::accepts(Level level) const {
+   return level != None && level <= this->level;
+}
+
+bool ArtifactSink::encode(QImage const & image, QString const & filename) const {
+   TraceSpan const span("ArtifactSink::encode");
+   switch (format) {
+   case PngFast:
+      // quality maps to the zlib level, high values barely compress but are fast
+      return image.save(filename, "PNG", 90);
+   case Ppm:
+      return image.save(filename, "PPM");
+   case Qoi: {
+      QFile file(filename);
+      return file.open(QFile::WriteOnly | QFile::Truncate) && file.write(encodeQoi(image)) >= 0;
+   }
+   default:
+      return image.save(filename, "PNG");
+   }
+}
+
+QByteArray ArtifactSink::encodeQoi(QImage const & image) {
+   // the "quite ok image format", lossless and an order of magnitude faster than png
+   QImage const rgba = image.convertToFormat(QImage::Format_RGBA8888);
+   int const width = rgba.width();
+   int const height = rgba.height();
+   QByteArray data;
+   data.reserve(22 + width*height*5);
+   data.append("qoif", 4);
+   for (int shift=24; shift>=0; shift-=8) {
+      data.append(char(width >> shift));
+   }
+   for (int shift=24; shift>=0; shift-=8) {
+      data.append(char(height >> shift));
+   }
+   data.append(char(4));
+   data.append(char(0));
+
+   quint32 index[64] = {};
+   uchar prev[4] = {0, 0, 0, 255};
+   int run = 0;
+   for (int y=0; y<height; ++y) {
+      uchar const * px = rgba.constScanLine(y);
+      for (int x=0; x<width; ++x, px+=4) {
+         bool const last = y == height-1 && x == width-1;
+         if (memcmp(px, prev, 4) == 0) {
+            ++run;
+            if (run == 62 || last) {
+               data.append(char(0xc0 | (run-1)));
+               run = 0;
+            }
+            continue;
+         }
+         if (run > 0) {
+            data.append(char(0xc0 | (run-1)));
+            run = 0;
+         }
+
+         quint32 value;
+         memcpy(&value, px, 4);
+         int const hash = (px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) % 64;
+         if (index[hash] == value) {
+            data.append(char(hash));
+         }
+         else {
+            index[hash] = value;
+            if (px[3] == prev[3]) {
+               int const dr = qint8(px[0] - prev[0]);
+               int const dg = qint8(px[1] - prev[1]);
+               int const db = qint8(px[2] - prev[2]);
+               if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                  data.append(char(0x40 | (dr+2) << 4 | (dg+2) << 2 | (db+2)));
+               }
+               else if (dg >= -32 && dg <= 31 && dr-dg >= -8 && dr-dg <= 7 && db-dg >= -8 && db-dg <= 7) {
+                  data.append(char(0x80 | (dg+32)));
+                  data.append(char((dr-dg+8) << 4 | (db-dg+8)));
+               }
+               else {
+                  data.append(char(0xfe));
+                  data.append(reinterpret_cast<char const *>(px), 3);
+               }
+            }
+            else {
+               data.append(char(0xff));
+               data.append(reinterpret_cast<char const *>(px), 4);
+            }
+         }
+         memcpy(prev, px, 4);
+      }
+   }
+
+   // end marker
+   data.append(QByteArray(7, 0));
+   data.append(char(1));
+   return data;
+}
+
+void ArtifactSink::enqueue(std::function<QImage()> const & render, QString const & filename) {
+   // blocks while the encoders are behind, so a fast producer cannot pile up images
+   freeSlots.acquire();
+   QString const target = path(filename);
+   QtConcurrent::run(&encoders, [this, render, target]() {
+      if (!encode(render(), target)) {
+         qWarning("Cannot write image %s", qPrintable(target));
+         failures.ref();
+      }
+      freeSlots.release();
+   });
+}
+
+ArtifactSink::Level ArtifactSink::getLevel() const {
+   return level;
+}
+
+QString ArtifactSink::path(QString const & filename) const {
+   // the callers name their images *.png, the suffix follows the format
+   QFileInfo const info(filename);
+   QString const base = info.path() + "/" + info.completeBaseName();
+   switch (format) {
+   case Ppm:
+      return base + ".ppm";
+   case Qoi:
+      return base + ".qoi";
+   default:
+      return base + ".png";
+   }
+}
+
+void ArtifactSink::setFormat(Format format) {
+   this->format = format;
+}
+
+void ArtifactSink::setLevel(Level level) {
+   this->level = level;
+}
+
+void ArtifactSink::setThreadCount(int count) {
+   encoders.setMaxThreadCount(std::max(1, count));
+}
+
+int ArtifactSink::waitForDone() {
+   encoders.waitForDone();
+   return failures.fetchAndStoreOrdered(0);
+}
+
+void ArtifactSink::write(Level level, QImage const & image, QString const & filename) {
+   if (accepts(level)) {
+      enqueue([image]() { return image; }, filename);
+   }
+}
+
+void ArtifactSink::write(Level level, ImageColor const & image, QString const & filename) {
+   // converted to rgb on the encoder thread
+   if (accepts(level)) {
+      QSharedPointer<ImageColor const> const copy(new ImageColor(image));
+      enqueue([copy]() { return copy->toQImage(); }, filename);
+   }
+}
+
+void ArtifactSink::write(Level level, ImageGray const & image, QString const & filename) {
+   if (accepts(level)) {
+      QSharedPointer<ImageGray const> const copy(new ImageGray(image));
+      enqueue([copy]() { return copy->toQImage(); }, filename);
+   }
+}
@@ -0,0 +1,47 @@
+#ifndef ARTIFACTSINK_H
+#define ARTIFACTSINK_H
+
+#include <functional>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QImage>
+#include <QSemaphore>
+#include <QString>
+#include <QThreadPool>
+#include "image.h"
+
+class ArtifactSink {
+
+public:
+   enum Level { None, Results, Debug };
+   enum Format { Png, PngFast, Ppm, Qoi };
+
+   explicit ArtifactSink(Level level = Results, Format format = Png, int capacity = 32);
+   ~ArtifactSink();
+
+   bool accepts(Level level) const;
+   Level getLevel() const;
+   void setFormat(Format format);
+   void setLevel(Level level);
+   void setThreadCount(int count);
+   int waitForDone();
+   void write(Level level, QImage const & image, QString const & filename);
+   void write(Level level, ImageColor const & image, QString const & filename);
+   void write(Level level, ImageGray const & image, QString const & filename);
+
+private:
+   Level level;
+   Format format;
+   QThreadPool encoders;
+   // the images waiting for an encoder, writers block while it is used up
+   QSemaphore freeSlots;
+   QAtomicInt failures;
+
+   bool encode(QImage const & image, QString const & filename) const;
+   void enqueue(std::function<QImage()> const & render, QString const & filename);
+   QString path(QString const & filename) const;
+
+   static QByteArray encodeQoi(QImage const & image);
+};
+
+#endif // ARTIFACTSINK_H
@@ -0,0 +1,238 @@
+#include "batchpipeline.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QSet>
+#include <QSharedPointer>
+#include <QtConcurrent>
+#include "arranger.h"
+#include "artifactsink.h"
+#include "boundedqueue.h"
+#include "decomposer.h"
+#include "runcontrol.h"
+#include "trace.h"
+
+BatchPipeline::BatchPipeline(Decomposer const & decomposer, QList<Arranger *> const & arrangers,
+                             QString const & outputDir) :
+   decomposer(decomposer), arrangers(arrangers), outputDir(outputDir), artifacts(nullptr), control(nullptr),
+   cache(QString()), queueCapacity(2), threadCounts{1, 2, 1, 2}
+{
+}
+
+bool BatchPipeline::canceled() const {
+   return control && control->isCanceled();
+}
+
+QStringList BatchPipeline::imagesInDirectory(QString const & path) {
+   QStringList filters;
+   foreach (QByteArray const & format, QImageReader::supportedImageFormats()) {
+      filters << "*." + QString(format);
+   }
+   QDir const dir(path);
+   QStringList images;
+   foreach (QString const & filename, dir.entryList(filters, QDir::Files, QDir::Name)) {
+      images << dir.filePath(filename);
+   }
+   return images;
+}
+
+QStringList BatchPipeline::outputNames(QStringList const & filenames) {
+   // images that share a base name keep their suffix, any further clash gets a number
+   QHash<QString, int> baseNames;
+   foreach (QString const & filename, filenames) {
+      ++baseNames[QFileInfo(filename).completeBaseName()];
+   }
+   QSet<QString> used;
+   QStringList names;
+   foreach (QString const & filename, filenames) {
+      QFileInfo const info(filename);
+      QString name = info.completeBaseName();
+      if (baseNames.value(name) > 1 && !info.suffix().isEmpty()) {
+         name += "_" + info.suffix();
+      }
+      QString unique = name;
+      for (int n=2; used.contains(unique); ++n) {
+         unique = QString("%1_%2").arg(name).arg(n);
+      }
+      used.insert(unique);
+      names << unique;
+   }
+   return names;
+}
+
+int BatchPipeline::run(QStringList const & filenames) {
+   // every stage hands its items to the next one through a bounded queue, so a
+   // slow stage holds back the ones before it instead of piling up images
+   BoundedQueue<int> files(filenames.size());
+   BoundedQueue<BatchItem *> decoded(queueCapacity);
+   BoundedQueue<BatchItem *> decomposed(queueCapacity);
+   BoundedQueue<BatchItem *> prepared(queueCapacity);
+   for (int f=0; f<filenames.size(); ++f) {
+      files.push(f);
+   }
+   files.close();
+   failures.store(0);
+   if (control) {
+      control->setStage(QObject::tr("Processing images"), filenames.size());
+   }
+
+   int threads = 0;
+   for (int s=0; s<StageCount; ++s) {
+      threads += threadCounts[s];
+   }
+   workers.setMaxThreadCount(threads);
+
+   // every image gets its own output directory
+   QDir const output(outputDir);
+   QStringList const names = outputNames(filenames);
+   startStage(Decode, [this, &filenames, &files, &decoded, &output, &names]() {
+      // a canceled run reads no further images, the later stages drain their queues
+      int f;
+      if (canceled() || !files.pop(f)) {
+         return false;
+      }
+      QString const & filename = filenames.at(f);
+      TraceSpan const span("BatchPipeline::decode");
+      BatchItem * item = new BatchItem();
+#ifdef TIDY_STATS
+      StatsScope const scope(&item->stats);
+#endif
+      TIDY_STAGE(QObject::tr("Decoding"));
+      item->filename = filename;
+      item->name = output.filePath(names.at(f));
+      item->image = ImageColor(filename);
+      if (item->image.area() == 0) {
+         qWarning("Cannot read image %s", qPrintable(filename));
+         failures.ref();
+         delete item;
+         if (control) {
+            control->advance();
+         }
+      }
+      else {
+         decoded.push(item);
+      }
+      return true;
+   }, [&decoded]() { decoded.close(); });
+
+   startStage(Decompose, [this, &decoded, &decomposed]() {
+      BatchItem * item;
+      if (!decoded.pop(item)) {
+         return false;
+      }
+#ifdef TIDY_STATS
+      StatsScope const scope(&item->stats);
+#endif
+      TIDY_STAGE(QObject::tr("Decomposing"));
+      // reuse the segments of an earlier run on the same image and parameters
+      QByteArray const key = SegmentCache::key(item->image, decomposer);
+      if (!canceled() && !cache.load(key, item->image, item->segments)) {
+         item->segments = decomposer.decomposeBatch(item->image, item->name);
+         if (!canceled()) {
+            cache.store(key, item->image, item->segments);
+         }
+      }
+      if (canceled()) {
+         item->segments.deleteAndClear();
+         delete item;
+      }
+      else {
+         decomposed.push(item);
+      }
+      return true;
+   }, [&decomposed]() { decomposed.close(); });
+
+   startStage(Prepare, [this, &decomposed, &prepared]() {
+      BatchItem * item;
+      if (!decomposed.pop(item)) {
+         return false;
+      }
+      if (canceled()) {
+         item->segments.deleteAndClear();
+         delete item;
+         return true;
+      }
+#ifdef TIDY_STATS
+      StatsScope const scope(&item->stats);
+#endif
+      TIDY_STAGE(QObject::tr("Preparing"));
+      item->segments.prepare();
+      // the pixels are copied into the segments, the image is not needed anymore
+      item->image = ImageColor();
+      prepared.push(item);
+      return true;
+   }, [&prepared]() { prepared.close(); });
+
+   startStage(Arrange, [this, &prepared]() {
+      BatchItem * item;
+      if (!prepared.pop(item)) {
+         return false;
+      }
+#ifdef TIDY_STATS
+      StatsScope const scope(&item->stats);
+#endif
+      TIDY_STAGE(QObject::tr("Arranging"));
+      foreach (Arranger const * const arranger, arrangers) {
+         if (!canceled()) {
+            arranger->arrangeBatch(item->segments, item->name);
+         }
+      }
+      item->segments.deleteAndClear();
+#ifdef TIDY_STATS
+      // next to the output.txt of the decomposer
+      item->stats.leaveStage();
+      if (!canceled() && !item->stats.save(item->name + "/stats.json")) {
+         qWarning("Cannot write stats of %s", qPrintable(item->filename));
+         failures.ref();
+      }
+#endif
+      qDebug("Batch of %s arranged", qPrintable(item->filename));
+      delete item;
+      if (control) {
+         control->advance();
+      }
+      return true;
+   }, []() {});
+
+   // the images are encoded and written by the artifact sink in the background
+   workers.waitForDone();
+   if (artifacts) {
+      failures.fetchAndAddRelaxed(artifacts->waitForDone());
+   }
+   return failures.load();
+}
+
+void BatchPipeline::setArtifactSink(ArtifactSink * sink) {
+   artifacts = sink;
+}
+
+void BatchPipeline::setCache(SegmentCache const & cache) {
+   this->cache = cache;
+}
+
+void BatchPipeline::setQueueCapacity(int capacity) {
+   queueCapacity = std::max(1, capacity);
+}
+
+void BatchPipeline::setRunControl(RunControl * control) {
+   this->control = control;
+}
+
+void BatchPipeline::setThreadCount(Stage stage, int count) {
+   threadCounts[stage] = std::max(1, count);
+}
+
+void BatchPipeline::startStage(Stage stage, std::function<bool()> const & step,
+                               std::function<void()> const & finished) {
+   // the last worker of a stage to run dry closes the queue of the next stage
+   QSharedPointer<QAtomicInt> running(new QAtomicInt(threadCounts[stage]));
+   for (int t=0; t<threadCounts[stage]; ++t) {
+      QtConcurrent::run(&workers, [step, finished, running]() {
+         while (step()) {}
+         if (!running->deref()) {
+            finished();
+         }
+      });
+   }
+}
@@ -0,0 +1,65 @@
+#ifndef BATCHPIPELINE_H
+#define BATCHPIPELINE_H
+
+#include <functional>
+#include <QAtomicInt>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include "image.h"
+#include "segmentcache.h"
+#include "segmentlist.h"
+#include "stats.h"
+
+class Arranger;
+class ArtifactSink;
+class Decomposer;
+class RunControl;
+
+class BatchPipeline {
+
+public:
+   enum Stage { Decode, Decompose, Prepare, Arrange, StageCount };
+
+   BatchPipeline(Decomposer const & decomposer, QList<Arranger *> const & arrangers,
+                 QString const & outputDir);
+
+   void setArtifactSink(ArtifactSink * sink);
+   void setCache(SegmentCache const & cache);
+   void setQueueCapacity(int capacity);
+   void setRunControl(RunControl * control);
+   void setThreadCount(Stage stage, int count);
+   int run(QStringList const & filenames);
+
+   static QStringList imagesInDirectory(QString const & path);
+
+private:
+   struct BatchItem {
+      QString filename;
+      QString name;
+      ImageColor image;
+      SegmentList segments;
+#ifdef TIDY_STATS
+      Stats stats;
+#endif
+   };
+
+   Decomposer const & decomposer;
+   QList<Arranger *> arrangers;
+   QString outputDir;
+   ArtifactSink * artifacts;
+   RunControl * control;
+   SegmentCache cache;
+   int queueCapacity;
+   int threadCounts[StageCount];
+   QThreadPool workers;
+   QAtomicInt failures;
+
+   bool canceled() const;
+   static QStringList outputNames(QStringList const & filenames);
+   void startStage(Stage stage, std::function<bool()> const & step,
+                   std::function<void()> const & finished);
+};
+
+#endif // BATCHPIPELINE_H
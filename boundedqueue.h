@@ -0,0 +1,63 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <algorithm>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+template <typename T>
+class BoundedQueue {
+
+public:
+   explicit BoundedQueue(int capacity) :
+      capacity(std::max(1, capacity)), closed(false)
+   {
+   }
+
+   // blocks while the queue is full, fails once the queue is closed
+   bool push(T const & item) {
+      QMutexLocker locker(&mutex);
+      while (queue.size() >= capacity && !closed) {
+         notFull.wait(&mutex);
+      }
+      if (closed) {
+         return false;
+      }
+      queue.enqueue(item);
+      notEmpty.wakeOne();
+      return true;
+   }
+
+   // blocks while the queue is empty, fails once it is closed and drained
+   bool pop(T & item) {
+      QMutexLocker locker(&mutex);
+      while (queue.isEmpty() && !closed) {
+         notEmpty.wait(&mutex);
+      }
+      if (queue.isEmpty()) {
+         return false;
+      }
+      item = queue.dequeue();
+      notFull.wakeOne();
+      return true;
+   }
+
+   // no more items are accepted, the remaining ones can still be popped
+   void close() {
+      QMutexLocker locker(&mutex);
+      closed = true;
+      notEmpty.wakeAll();
+      notFull.wakeAll();
+   }
+
+private:
+   int capacity;
+   bool closed;
+   QQueue<T> queue;
+   QMutex mutex;
+   QWaitCondition notEmpty;
+   QWaitCondition notFull;
+};
+
+#endif // BOUNDEDQUEUE_H
@@ -0,0 +1,68 @@
+#include "broadphase.h"
+#include <algorithm>
+#include <cmath>
+#include "layoutstate.h"
+#include "stats.h"
+
+BroadPhase::BroadPhase(LayoutState const & layout) :
+   layout(layout), cellSize(1.0)
+{
+}
+
+QVector<IndexPair> const & BroadPhase::candidatePairs() const {
+   return pairs;
+}
+
+int BroadPhase::cell(double coordinate) const {
+   return int(std::floor(coordinate / cellSize));
+}
+
+void BroadPhase::update() {
+   int const count = layout.size();
+
+   // cache the rotated bounding boxes (slightly enlarged to stay conservative)
+   bounds.resize(count);
+   double extent = 0.0;
+   for (int i=0; i<count; ++i) {
+      bounds[i] = layout.boundingRect(i).adjusted(-0.5, -0.5, 0.5, 0.5);
+      extent += std::max(bounds.at(i).width(), bounds.at(i).height());
+   }
+   cellSize = count>0 ? std::max(1.0, extent/count) : 1.0;
+
+   // sort the segments into the grid
+   cells.clear();
+   for (int i=0; i<count; ++i) {
+      for (int y=cell(bounds.at(i).top()); y<=cell(bounds.at(i).bottom()); ++y) {
+         for (int x=cell(bounds.at(i).left()); x<=cell(bounds.at(i).right()); ++x) {
+            cells[QPair<int, int>(x, y)] << i;
+         }
+      }
+   }
+
+   // gather overlapping pairs
+   pairs.clear();
+   QRectF overlap;
+   int i, j;
+   for (auto it=cells.constBegin(); it!=cells.constEnd(); ++it) {
+      QVector<int> const & indices = it.value();
+      for (int a=0; a<indices.size()-1; ++a) {
+         for (int b=a+1; b<indices.size(); ++b) {
+            i = indices.at(a);
+            j = indices.at(b);
+            if (bounds.at(i).intersects(bounds.at(j))) {
+               // report each pair only in the cell holding the overlap's top left corner
+               overlap = bounds.at(i) & bounds.at(j);
+               if (cell(overlap.left()) == it.key().first &&
+                   cell(overlap.top()) == it.key().second) {
+                  pairs << IndexPair(i, j);
+               }
+            }
+         }
+      }
+   }
+
+   // keep the order of the all-pairs loop
+   std::sort(pairs.begin(), pairs.end());
+   TIDY_COUNT(BroadPhaseUpdates, 1);
+   TIDY_COUNT(BroadPhaseRejections, qint64(count)*(count-1)/2 - pairs.size());
+}
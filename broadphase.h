@@ -0,0 +1,31 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <QHash>
+#include <QPair>
+#include <QRectF>
+#include <QVector>
+
+class LayoutState;
+
+using IndexPair = QPair<int, int>;
+
+class BroadPhase {
+
+public:
+   explicit BroadPhase(LayoutState const & layout);
+
+   void update();
+   QVector<IndexPair> const & candidatePairs() const;
+
+private:
+   LayoutState const & layout;
+   double cellSize;
+   QVector<QRectF> bounds;
+   QHash<QPair<int, int>, QVector<int>> cells;
+   QVector<IndexPair> pairs;
+
+   int cell(double coordinate) const;
+};
+
+#endif // BROADPHASE_H
@@ -0,0 +1,217 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include "artifactsink.h"
+#include "batchpipeline.h"
+#include "meanshiftdecomposer.h"
+#include "watersheddecomposer.h"
+#include "forcedirectedarranger.h"
+#include "clusteredarranger.h"
+#include "packingarranger.h"
+#include "trace.h"
+
+// reads the image files of a manifest, one per line relative to the manifest,
+// empty lines and lines starting with # are skipped
+static bool readManifest(QString const & filename, QStringList & images) {
+   QFile file(filename);
+   if (!file.open(QFile::ReadOnly | QFile::Text)) {
+      return false;
+   }
+   QDir const dir(QFileInfo(filename).absolutePath());
+   QTextStream in(&file);
+   QString line;
+   while (!in.atEnd()) {
+      line = in.readLine().trimmed();
+      if (!line.isEmpty() && !line.startsWith('#')) {
+         images << dir.filePath(line);
+      }
+   }
+   return true;
+}
+
+int main(int argc, char * argv[]) {
+   // no gui application, the batch runs on servers without a display
+   QCoreApplication app(argc, argv);
+   QCoreApplication::setApplicationName("tidy-cli");
+   QTextStream err(stderr);
+
+   QCommandLineParser parser;
+   parser.setApplicationDescription("Decomposes images and arranges their segments for all feature pairs.");
+   parser.addHelpOption();
+   parser.addPositionalArgument("images", "The image files or directories to process.", "[images...]");
+   QCommandLineOption manifestOption(QStringList() << "m" << "manifest",
+                                     "Read further image files from <file>, one per line.", "file");
+   parser.addOption(manifestOption);
+   QCommandLineOption decomposerOption(QStringList() << "d" << "decomposer",
+                                       "The decomposer: meanshift (default) or watershed.", "name", "meanshift");
+   parser.addOption(decomposerOption);
+   QCommandLineOption arrangerOption(QStringList() << "a" << "arranger",
+                                     "Run the arranger forcedirected, clustered or packing (default all).", "name");
+   parser.addOption(arrangerOption);
+   QCommandLineOption parameterOption(QStringList() << "p" << "parameter",
+                                      "Set a parameter, e.g. sigmaPos=16, maxSeconds=30 or shape=piles.", "key=value");
+   parser.addOption(parameterOption);
+   QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                   "Write the results to <dir> (default the working directory).", "dir", ".");
+   parser.addOption(outputOption);
+   QCommandLineOption levelOption(QStringList() << "l" << "level",
+                                  "Write no images, the results (default) or also the debug images.",
+                                  "none|results|debug", "results");
+   parser.addOption(levelOption);
+   QCommandLineOption formatOption(QStringList() << "f" << "format",
+                                   "The image format: png (default), png-fast, ppm or qoi.", "format", "png");
+   parser.addOption(formatOption);
+   QCommandLineOption threadsOption(QStringList() << "t" << "threads",
+                                    "Set the thread count of a pipeline stage (decode, decompose, prepare, arrange or write).", "stage=count");
+   parser.addOption(threadsOption);
+   QCommandLineOption queueOption(QStringList() << "q" << "queue",
+                                  "The number of images waiting between two stages (default 2).", "count", "2");
+   parser.addOption(queueOption);
+   QCommandLineOption cacheOption(QStringList() << "c" << "cache",
+                                  "Keep the decomposed segments in <dir> and reuse them.", "dir",
+                                  SegmentCache::defaultDirectory());
+   parser.addOption(cacheOption);
+   QCommandLineOption noCacheOption("no-cache", "Always decompose, neither read nor write the cache.");
+   parser.addOption(noCacheOption);
+   QCommandLineOption traceOption("trace",
+                                  "Write a timeline of the run to <file>, to be opened in chrome://tracing or Perfetto.",
+                                  "file");
+   parser.addOption(traceOption);
+   parser.process(app);
+
+   // gather the images
+   QStringList images;
+   foreach (QString const & argument, parser.positionalArguments()) {
+      if (QFileInfo(argument).isDir()) {
+         images << BatchPipeline::imagesInDirectory(argument);
+      }
+      else {
+         images << argument;
+      }
+   }
+   foreach (QString const & manifest, parser.values(manifestOption)) {
+      if (!readManifest(manifest, images)) {
+         err << "Cannot read manifest " << manifest << endl;
+         return 1;
+      }
+   }
+   if (images.isEmpty()) {
+      parser.showHelp(1);
+   }
+
+   // create the decomposer and arrangers
+   Decomposer * decomposer = nullptr;
+   QString const decomposerName = parser.value(decomposerOption);
+   if (decomposerName == "meanshift") {
+      decomposer = new MeanShiftDecomposer();
+   }
+   else if (decomposerName == "watershed") {
+      decomposer = new WaterShedDecomposer();
+   }
+   else {
+      err << "Unknown decomposer " << decomposerName << endl;
+      return 1;
+   }
+
+   QList<Arranger *> arrangers;
+   QStringList arrangerNames = parser.values(arrangerOption);
+   if (arrangerNames.isEmpty()) {
+      arrangerNames << "forcedirected" << "clustered" << "packing";
+   }
+   foreach (QString const & arrangerName, arrangerNames) {
+      if (arrangerName == "forcedirected") {
+         arrangers << new ForceDirectedArranger();
+      }
+      else if (arrangerName == "clustered") {
+         arrangers << new ClusteredArranger();
+      }
+      else if (arrangerName == "packing") {
+         arrangers << new PackingArranger();
+      }
+      else {
+         err << "Unknown arranger " << arrangerName << endl;
+         delete decomposer;
+         qDeleteAll(arrangers);
+         return 1;
+      }
+   }
+
+   // every parameter has to be accepted by at least one of them
+   int result = 0;
+   foreach (QString const & parameter, parser.values(parameterOption)) {
+      int const split = parameter.indexOf('=');
+      QString const key = parameter.left(split).trimmed();
+      QString const value = parameter.mid(split+1).trimmed();
+      bool accepted = split > 0 && decomposer->setParameter(key, value);
+      foreach (Arranger * const arranger, arrangers) {
+         accepted = (split > 0 && arranger->setParameter(key, value)) || accepted;
+      }
+      if (!accepted) {
+         err << "Unknown parameter or invalid value " << parameter << endl;
+         result = 1;
+      }
+   }
+
+   // images are encoded and written in the background
+   QStringList levels;
+   levels << "none" << "results" << "debug";
+   QStringList formats;
+   formats << "png" << "png-fast" << "ppm" << "qoi";
+   int const level = levels.indexOf(parser.value(levelOption));
+   int const format = formats.indexOf(parser.value(formatOption));
+   if (level < 0 || format < 0) {
+      err << "Unknown output level or format" << endl;
+      result = 1;
+   }
+   ArtifactSink artifacts(ArtifactSink::Level(std::max(0, level)), ArtifactSink::Format(std::max(0, format)));
+   decomposer->setArtifactSink(&artifacts);
+   // every image is decomposed once, the stages of one are never reused
+   decomposer->setStageCacheMegaBytes(0);
+   foreach (Arranger * const arranger, arrangers) {
+      arranger->setArtifactSink(&artifacts);
+   }
+
+   // the stages are given by name, in pipeline order, writing is done by the sink
+   BatchPipeline pipeline(*decomposer, arrangers, parser.value(outputOption));
+   pipeline.setArtifactSink(&artifacts);
+   pipeline.setQueueCapacity(parser.value(queueOption).toInt());
+   if (!parser.isSet(noCacheOption)) {
+      pipeline.setCache(SegmentCache(parser.value(cacheOption)));
+   }
+   QStringList stages;
+   stages << "decode" << "decompose" << "prepare" << "arrange";
+   foreach (QString const & threads, parser.values(threadsOption)) {
+      int const split = threads.indexOf('=');
+      QString const name = threads.left(split).trimmed();
+      int const stage = stages.indexOf(name);
+      bool ok;
+      int const count = threads.mid(split+1).toInt(&ok);
+      if (split < 0 || (stage < 0 && name != "write") || !ok) {
+         err << "Invalid thread count " << threads << endl;
+         result = 1;
+      }
+      else if (stage < 0) {
+         artifacts.setThreadCount(count);
+      }
+      else {
+         pipeline.setThreadCount(BatchPipeline::Stage(stage), count);
+      }
+   }
+
+   // unreadable images are reported and skipped
+   Trace::setEnabled(parser.isSet(traceOption));
+   if (result == 0 && pipeline.run(images) > 0) {
+      result = 1;
+   }
+   if (parser.isSet(traceOption) && !Trace::save(parser.value(traceOption))) {
+      err << "Cannot write trace " << parser.value(traceOption) << endl;
+      result = 1;
+   }
+
+   delete decomposer;
+   qDeleteAll(arrangers);
+   return result;
+}
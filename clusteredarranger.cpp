@@ -1,85 +1,75 @@
 #include "clusteredarranger.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <QComboBox>
 #include <QDir>
 #include <QFile>
 #include <QFormLayout>
-#include <QGraphicsScene>
+#include <QStringList>
 #include <QTextStream>
 #include <QTime>
+#include <QtConcurrent>
+#include "broadphase.h"
+#include "layoutstate.h"
+#include "pointgrid.h"
 #include "segment.h"
 #include "segmentlist.h"
+#include "stats.h"
+#include "trace.h"
 
 ClusteredArranger::ClusteredArranger() :
    Arranger("Clustered Arranger (FD)")
 {
-   populateSettingsLayout();
 }
 
-QGraphicsScene * ClusteredArranger::arrange(SegmentList const & segments) const {
-   QGraphicsScene * arrangement = new QGraphicsScene();
-
-   QTime time;
-   time.start();
+Arrangement ClusteredArranger::arrange(SegmentList const & segments) const {
+   ClusteredParameters const params = parameters;
+   RefineBudget const budget = refineBudget(params);
+   TraceSpan const span("ClusteredArranger::arrange");
 
    // determine background
    Segment * background = determineBackground(segments);
    SegmentList segmentsWOBack = removeBackground(segments, background);
-   arrangement->setBackgroundBrush(QBrush(QColor(background->color().toQRgb())));
    segmentsWOBack.calculateFeatureVariances();
 
    // initialize layout
-   //initializeLayout(segmentsWOBack, segmentsWOBack.featX(), segmentsWOBack.featY());
-   initializeLayout(segmentsWOBack, xAxisBox->currentIndex(), yAxisBox->currentIndex());
+   LayoutState layout(segmentsWOBack);
+   //initializeLayout(layout, segmentsWOBack.featX(), segmentsWOBack.featY());
+   initializeLayout(layout, params.xAxis, params.yAxis);
 
    // find clusters
-   time.restart();
-   QList<SegmentList> clusters = meanShift(segmentsWOBack);
-   qDebug("Segments clustered in %f seconds", time.restart()/1000.0);
+   QList<LayoutState> clusters;
+   foreach (QVector<int> const & members, meanShift(layout)) {
+      clusters << layout.subset(members);
+   }
    qDebug("  %d clusters found", clusters.size());
 
    // refine clusters
-   //int counter = 0;
-   foreach (SegmentList cluster, clusters) {
-      if (clusterBox->currentIndex() == 0) {
-         refineLayoutCircles(cluster);
-      }
-      else if (clusterBox->currentIndex() == 1) {
-         refineLayoutPiles(cluster);
-      }
-
-      // debug output
-      /*QGraphicsScene scene;
-      scene.setBackgroundBrush(QBrush(QColor(255, 255, 255)));
-      foreach(Segment * const segment, cluster) {
-         scene.addItem(segment->toQGraphicsItem());
-         // without the following line QPainter tends to crash
-         scene.width();
-      }
-      ++counter;
-      saveScene(&scene, QString("Test%1.png").arg(counter, 2));*/
-   }
+   int const residual = refineClusters(clusters, params.shape, budget);
 
    // refine layout
-   if (clusterBox->currentIndex() == 0) {
-      refineLayoutByPlace(clusters);
+   if (params.shape == 0) {
+      refineLayoutByPlace(clusters, budget);
    }
-   else if (clusterBox->currentIndex() == 1) {
+   else if (params.shape == 1 || params.shape == 2) {
       refineLayoutBySize(clusters);
    }
-
-   // convert the segments to QGraphicsItems and add to QGraphicsScene
-   foreach(Segment const * const segment, segmentsWOBack) {
-      arrangement->addItem(segment->toQGraphicsItem());
-      // without the following line QPainter tends to crash
-      arrangement->width();
+   qDebug("  Residual collisions: %d", residual);
+   foreach (LayoutState const & cluster, clusters) {
+      layout.assign(cluster);
    }
-   saveScene(arrangement, "FD3_post.png");
 
-   return arrangement;
+   saveLayout(layout, background->color().toQRgb(), "FD3_post.png", ArtifactSink::Debug);
+
+   // the scene is built in the gui thread
+   return Arrangement{layout, background->color().toQRgb()};
 }
 
 void ClusteredArranger::arrangeBatch(SegmentList const & segments, QString const & name) const {
+   TraceSpan const span("ClusteredArranger::arrangeBatch");
+   ClusteredParameters const params = parameters;
    QDir dir;
    dir.mkpath(name + "/ClusteredArranger");
 
@@ -87,9 +77,6 @@ void ClusteredArranger::arrangeBatch(SegmentList const & segments, QString const
    file.open(QFile::WriteOnly | QFile::Truncate);
    QTextStream out(&file);
 
-   QTime time;
-   time.start();
-
    // determine background
    Segment * background = determineBackground(segments);
    SegmentList segmentsWOBack = removeBackground(segments, background);
@@ -99,200 +86,268 @@ void ClusteredArranger::arrangeBatch(SegmentList const & segments, QString const
    out << "   y = " << FeatureVector::toString(segmentsWOBack.featY()) << endl;
    out << endl;
 
-   for (int i=0; i<9; ++i) {
-      for (int j=i+1; j<10; ++j) {
-         out << "Arrangement:" << endl;
-         out << "   x = " << FeatureVector::toString(i) << endl;
-         out << "   y = " << FeatureVector::toString(j) << endl;
-
-         // initialize layout
-         initializeLayout(segmentsWOBack, i, j);
-
-         // find clusters
-         time.restart();
-         QList<SegmentList> clusters = meanShift(segmentsWOBack);
-         out << "   Segments clustered in " << time.restart()/1000.0 << " seconds" << endl;
-         out << "      " << clusters.size() << " clusters found" << endl;
-
-         // CIRCLES
-         // refine clusters
-         segmentsWOBack.resetAngles();
-         time.restart();
-         foreach (SegmentList cluster, clusters) {
-            refineLayoutCircles(cluster);
-         }
-         // refine layout
-         refineLayoutByPlace(clusters);
-         out << "   Sphere clusteres refined in " << time.restart()/1000.0 << " seconds" << endl;
-         // convert the segments to QGraphicsItems and add to QGraphicsScene
-         QGraphicsScene * arrangement = new QGraphicsScene();
-         arrangement->setBackgroundBrush(QBrush(QColor(background->color().toQRgb())));
-         foreach(Segment const * const segment, segmentsWOBack) {
-            arrangement->addItem(segment->toQGraphicsItem());
-            // without the following line QPainter tends to crash
-            arrangement->width();
-         }
-         saveScene(arrangement, name + "/ClusteredArranger" +
-                                QString("/%1_%2_Circles.png").arg(FeatureVector::toString(i))
-                                                     .arg(FeatureVector::toString(j)));
-
-         // PILES
-         delete arrangement;
-         initializeLayout(segmentsWOBack, i, j);
-         segmentsWOBack.resetAngles();
-         // refine clusters
-         time.restart();
-         foreach (SegmentList cluster, clusters) {
-            refineLayoutPiles(cluster);
-         }
-         // refine layout
-         refineLayoutBySize(clusters);
-         out << "   Piles clusteres refined in " << time.restart()/1000.0 << " seconds" << endl;
-         // convert the segments to QGraphicsItems and add to QGraphicsScene
-         arrangement = new QGraphicsScene();
-         arrangement->setBackgroundBrush(QBrush(QColor(background->color().toQRgb())));
-         foreach(Segment const * const segment, segmentsWOBack) {
-            arrangement->addItem(segment->toQGraphicsItem());
-            // without the following line QPainter tends to crash
-            arrangement->width();
-         }
-         saveScene(arrangement, name +
-                                "/ClusteredArranger" +
-                                QString("/%1_%2_Piles.png").arg(FeatureVector::toString(i))
-                                                     .arg(FeatureVector::toString(j)));
+   // arrange the feature pairs concurrently, each on its own layouts
+   RefineBudget const budget = refineBudget(params);
+   auto arrangePair = [this, &segmentsWOBack, &budget](int i, int j, BatchResult const *) {
+      BatchResult result{i, j, QString(), QList<LayoutState>(), 0};
+      QTextStream log(&result.log);
+      log << "Arrangement:" << endl;
+      log << "   x = " << FeatureVector::toString(i) << endl;
+      log << "   y = " << FeatureVector::toString(j) << endl;
+
+      // initialize layout
+      LayoutState layout(segmentsWOBack);
+      initializeLayout(layout, i, j);
+
+      // find clusters
+      QTime time;
+      time.start();
+      QList<QVector<int>> const members = meanShift(layout);
+      log << "   Segments clustered in " << time.restart()/1000.0 << " seconds" << endl;
+      log << "      " << members.size() << " clusters found" << endl;
+
+      // CIRCLES
+      // refine clusters
+      QList<LayoutState> clusters;
+      foreach (QVector<int> const & indices, members) {
+         clusters << layout.subset(indices);
+      }
+      time.restart();
+      RefineBudget budgetCircles = budget;
+      budgetCircles.restart();
+      int residual = refineClusters(clusters, 0, budgetCircles);
+      // refine layout
+      refineLayoutByPlace(clusters, budgetCircles);
+      log << "   Sphere clusteres refined in " << time.restart()/1000.0 << " seconds" << endl;
+      log << "      Residual collisions: " << residual << endl;
+      result.residual = residual;
+      LayoutState circles = layout;
+      foreach (LayoutState const & cluster, clusters) {
+         circles.assign(cluster);
+      }
+      result.layouts << circles;
 
-         delete arrangement;
-         out << endl;
+      // PILES
+      // refine clusters
+      clusters.clear();
+      foreach (QVector<int> const & indices, members) {
+         clusters << layout.subset(indices);
       }
-   }
+      time.restart();
+      RefineBudget budgetPiles = budget;
+      budgetPiles.restart();
+      residual = refineClusters(clusters, 1, budgetPiles);
+      // refine layout
+      refineLayoutBySize(clusters);
+      log << "   Piles clusteres refined in " << time.restart()/1000.0 << " seconds" << endl;
+      log << "      Residual collisions: " << residual << endl;
+      LayoutState piles = layout;
+      foreach (LayoutState const & cluster, clusters) {
+         piles.assign(cluster);
+      }
+      result.layouts << piles;
+
+      log << endl;
+      log.flush();
+      return result;
+   };
+
+   // write the results in order
+   auto finishPair = [this, &out, &name, background](BatchResult const & result) {
+      out << result.log;
+
+      QStringList shapes;
+      shapes << "Circles" << "Piles";
+      for (int s=0; s<result.layouts.size(); ++s) {
+         // composite the layout without going through a QGraphicsScene
+         saveLayout(result.layouts.at(s), background->color().toQRgb(),
+                    name + "/ClusteredArranger" +
+                    QString("/%1_%2_%3.png").arg(FeatureVector::toString(result.featX))
+                                            .arg(FeatureVector::toString(result.featY))
+                                            .arg(shapes.at(s)));
+      }
+   };
+
+   sweepFeaturePairs(arrangePair, finishPair);
 
    file.close();
 }
 
-bool ClusteredArranger::biggerAreaThan(SegmentList const & listA, SegmentList const & listB) {
-   return listA.area() > listB.area();
+bool ClusteredArranger::biggerAreaThan(LayoutState const & layoutA, LayoutState const & layoutB) {
+   return layoutA.area() > layoutB.area();
 }
 
-bool ClusteredArranger::biggerThan(SegmentList const & listA, SegmentList const & listB) {
+bool ClusteredArranger::biggerThan(QVector<int> const & listA, QVector<int> const & listB) {
    return listA.size() > listB.size();
 }
 
-QList<SegmentList> ClusteredArranger::meanShift(SegmentList const & segments) const {
-   double const sigma = segments.area()>>5;
-   QList<Position> modi;
-   QList<int> ids;
+int ClusteredArranger::findRoot(QVector<int> & ids, int i) {
+   while (ids.at(i) != i) {
+      ids[i] = ids.at(ids.at(i));
+      i = ids.at(i);
+   }
+   return i;
+}
+
+QList<QVector<int>> ClusteredArranger::meanShift(LayoutState const & layout) const {
+   TraceSpan const span("ClusteredArranger::meanShift");
+   double const sigma = layout.area()>>5;
+   QVector<Position> const & positions = layout.positions();
+   PointGrid grid(positions, sqrt(sigma));
+   QVector<Position> modi;
 
    // filter the data
    Position center;
    Position nextCenter;
    int count;
-   foreach (Segment const * const segment, segments) {
-      nextCenter = segment->position();
+   foreach (Position const & position, positions) {
+      nextCenter = position;
       do {
          center = nextCenter;
          nextCenter = Position();
          count = 0;
-         foreach (Segment const * const other, segments) {
-            if ((other->position()-center).magnitudeSquared() < sigma) {
-               nextCenter += other->position();
-               ++count;
-            }
+         foreach (int const k, grid.within(center, sigma)) {
+            nextCenter += positions.at(k);
+            ++count;
          }
          nextCenter /= double(count);
       } while ((nextCenter - center).magnitudeSquared() > 0.01);
       modi << nextCenter;
-      ids << ids.size();
    }
 
-   // gather the modi
-   int oldID;
-   for (int i=0; i<modi.size()-1; ++i) {
-      for (int j=i+1; j<modi.size(); ++j) {
-         if (ids.at(i)!=ids.at(j) &&
-             (modi.at(i)-modi.at(j)).magnitudeSquared() < sigma) {
-            // merge
-            oldID = ids.at(j);
-            for (int k=0; k<modi.size(); ++k) {
-               if (ids.at(k) == oldID) {
-                  ids[k] = ids.at(i);
-               }
-            }
+   // gather the modi (union of all modi closer than sigma)
+   PointGrid modiGrid(modi, sqrt(sigma));
+   QVector<int> ids(modi.size());
+   for (int i=0; i<ids.size(); ++i) {
+      ids[i] = i;
+   }
+   int rootI, rootJ;
+   for (int i=0; i<modi.size(); ++i) {
+      foreach (int const j, modiGrid.within(modi.at(i), sigma)) {
+         rootI = findRoot(ids, i);
+         rootJ = findRoot(ids, j);
+         if (rootI != rootJ) {
+            ids[std::max(rootI, rootJ)] = std::min(rootI, rootJ);
          }
       }
    }
 
    // group the segments
-   QList<SegmentList> list;
+   QList<QVector<int>> list;
+   QHash<int, int> clusterOfRoot;
+   int root;
    for (int i=0; i<ids.size(); ++i) {
-      if (ids.contains(i)) {
-         SegmentList cluster;
-         for (int j=0; j<ids.size(); ++j) {
-            if (ids.at(j) == i) {
-               cluster << segments.at(j);
-            }
-         }
-         list << cluster;
+      root = findRoot(ids, i);
+      if (!clusterOfRoot.contains(root)) {
+         clusterOfRoot.insert(root, list.size());
+         list << QVector<int>();
       }
+      list[clusterOfRoot.value(root)] << i;
    }
 
    // sort the cluster-list (descending by size)
    std::sort(list.begin(), list.end(), biggerThan);
 
+   // label each segment with its cluster
+   QVector<int> labels(layout.size());
+   for (int c=0; c<list.size(); ++c) {
+      foreach (int const i, list.at(c)) {
+         labels[i] = c;
+      }
+   }
+
    // merge small clusters
    int const minSize = std::max(3, modi.size()/100);
    double minD;
    double tempMinD;
    int minI = -1;
+   int nearest;
    while (list.size()>1 && list.last().size() < minSize) {
       // find nearest neighbour
       minD = std::numeric_limits<double>::max();
-      for (int i=0; i<list.size()-1; ++i) {
-         tempMinD = minDist(list.at(i), list.last());
-         if (tempMinD < minD) {
-            minD = tempMinD;
-            minI = i;
+      foreach (int const i, list.last()) {
+         nearest = grid.nearest(positions.at(i), labels, list.size()-1);
+         if (nearest >= 0) {
+            tempMinD = (positions.at(nearest)-positions.at(i)).magnitudeSquared();
+            if (tempMinD < minD || (tempMinD == minD && labels.at(nearest) < minI)) {
+               minD = tempMinD;
+               minI = labels.at(nearest);
+            }
          }
       }
       // merge
-      list[minI].append(list.takeLast());
+      foreach (int const i, list.last()) {
+         labels[i] = minI;
+      }
+      list[minI] << list.takeLast();
    }
 
    return list;
 }
 
-double ClusteredArranger::minDist(SegmentList const & listA, SegmentList const & listB) const {
-   double min = std::numeric_limits<double>::max();
+void ClusteredArranger::populateSettingsLayout() {
+   populateAxisSettings(parameters);
 
-   foreach (Segment const * const segmentA, listA) {
-      foreach (Segment const * const segmentB, listB) {
-         min = std::min(min, (segmentA->position()-segmentB->position()).magnitude());
-      }
-   }
+   QComboBox * clusterBox = new QComboBox();
+   clusterBox->insertItem(0, "Circles");
+   clusterBox->insertItem(1, "Piles");
+   clusterBox->insertItem(2, "Piles (drop)");
+   clusterBox->setCurrentIndex(parameters.shape);
+   QObject::connect(clusterBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                    [this](int index) { parameters.shape = index; });
+   settingsLayout->addRow(QObject::tr("Shape"), clusterBox);
 
-   return min;
+   populateBudgetSettings(parameters);
 }
 
-void ClusteredArranger::populateSettingsLayout() {
-   xAxisBox = new QComboBox();
-   for (int i=0; i<10; ++i) {
-      xAxisBox->insertItem(i, FeatureVector::toString(i));
+int ClusteredArranger::refineClusters(QList<LayoutState> & clusters, int shape,
+                                      RefineBudget const & budget) const {
+   TraceSpan const span("ClusteredArranger::refineClusters");
+   struct ClusterJob {
+      LayoutState * cluster;
+      int residual;
+   };
+
+   // schedule the largest clusters first to balance the work
+   QList<ClusterJob> jobs;
+   for (int i=0; i<clusters.size(); ++i) {
+      jobs << ClusterJob{&clusters[i], 0};
    }
-   settingsLayout->addRow(QObject::tr("x axis"), xAxisBox);
+   std::sort(jobs.begin(), jobs.end(), [](ClusterJob const & a, ClusterJob const & b) {
+      return a.cluster->size() > b.cluster->size();
+   });
+
+   // clusters share no segments, so they can be refined concurrently
+#ifdef TIDY_STATS
+   Stats * const stats = Stats::current();
+#endif
+   QtConcurrent::blockingMap(jobs, [this, shape, &budget
+#ifdef TIDY_STATS
+                                    , stats
+#endif
+                                   ](ClusterJob & job) {
+#ifdef TIDY_STATS
+      StatsScope const scope(stats);
+#endif
+      if (shape == 0) {
+         job.residual = refineLayoutCircles(*job.cluster, budget);
+      }
+      else if (shape == 1) {
+         job.residual = refineLayoutPiles(*job.cluster, budget);
+      }
+      else if (shape == 2) {
+         job.residual = refineLayoutDrop(*job.cluster);
+      }
+   });
 
-   yAxisBox = new QComboBox();
-   for (int i=0; i<10; ++i) {
-      yAxisBox->insertItem(i, FeatureVector::toString(i));
+   int residual = 0;
+   foreach (ClusterJob const & job, jobs) {
+      residual += job.residual;
    }
-   yAxisBox->setCurrentIndex(1);
-   settingsLayout->addRow(QObject::tr("y axis"), yAxisBox);
-
-   clusterBox = new QComboBox();
-   clusterBox->insertItem(0, "Circles");
-   clusterBox->insertItem(1, "Piles");
-   settingsLayout->addRow(QObject::tr("Shape"), clusterBox);
+   return residual;
 }
 
-void ClusteredArranger::refineLayoutByPlace(QList<SegmentList> & clusters) const {
+void ClusteredArranger::refineLayoutByPlace(QList<LayoutState> & clusters, RefineBudget const & budget) const {
    int const count = clusters.size();
    std::unique_ptr<Position[]> centers(new Position[count]);
    std::unique_ptr<double[]> radii(new double[count]);
@@ -353,28 +408,30 @@ void ClusteredArranger::refineLayoutByPlace(QList<SegmentList> & clusters) const
       }
 
       ++pass;
-   } while (collisions > 0);
+   } while (collisions > 0 && !budget.exhausted(pass));
 }
 
-void ClusteredArranger::refineLayoutBySize(QList<SegmentList> & clusters) const {
+void ClusteredArranger::refineLayoutBySize(QList<LayoutState> & clusters) const {
    QRectF rect;
    double x = 0.0;
 
    // sort the cluster-list (descending by area)
    std::sort(clusters.begin(), clusters.end(), biggerAreaThan);
 
-   foreach (SegmentList cluster, clusters) {
-      rect = cluster.rect();
+   for (int i=0; i<clusters.size(); ++i) {
+      rect = clusters.at(i).rect();
       Position bl(rect.left(), rect.bottom());
 
-      cluster.translate(-bl + Position(x, 0.0));
+      clusters[i].translate(-bl + Position(x, 0.0));
       x += rect.width() + 50.0;
    }
 }
 
-void ClusteredArranger::refineLayoutCircles(SegmentList & segments) const {
-   int const count = segments.size();
+int ClusteredArranger::refineLayoutCircles(LayoutState & layout, RefineBudget const & budget) const {
+   int const count = layout.size();
    std::unique_ptr<Position[]> forces(new Position[count]);
+   BroadPhase broadPhase(layout);
+   LayoutIntegrator integrator(layout, budget);
    int collisions;
    Position forceVec;
    int pass = 0;
@@ -387,53 +444,131 @@ void ClusteredArranger::refineLayoutCircles(SegmentList & segments) const {
       }
 
       // find collisions
-      for (int i=0; i<count-1; ++i) {
-         for (int j=i+1; j<count; ++j) {
-            if (segments.at(i)->collides(segments.at(j))) {
-               // calculate force
-               forceVec = (segments.at(i)->position() - segments.at(j)->position()).normalized() * 2.0;
-               forces[i] += forceVec;
-               forces[j] -= forceVec;
-               ++collisions;
-            }
-         }
+      foreach (Contact const & contact, findCollisions(layout, broadPhase)) {
+         int const i = contact.first;
+         int const j = contact.second;
+         // calculate force
+         forceVec = contact.normal * std::max(2.0, contact.depth*0.5);
+         forces[i] += forceVec;
+         forces[j] -= forceVec;
+         ++collisions;
       }
 
       // apply forces
-      for (int i=0; i<count; ++i) {
-         segments[i]->translate(forces[i]);
-      }
+      integrator.step(forces.get(), nullptr, collisions, pass >= 10);
 
       // rotate (align to tangent)
-      Position center = segments.center();
-      foreach (Segment * const segment, segments) {
-         forceVec = segment->position() - center; // not actually a force here, just recycling
-         segment->setAngle(atan(forceVec.y / forceVec.x) + 1.570796327);
+      Position center = layout.center();
+      for (int i=0; i<count; ++i) {
+         forceVec = layout.position(i) - center; // not actually a force here, just recycling
+         layout.setAngle(i, atan(forceVec.y / forceVec.x) + 1.570796327);
       }
 
       // make it more compact
       if (pass < 10) {
-         foreach (Segment * const segment, segments) {
-            forceVec = (center - segment->position()) * 0.05 * (10-pass);
-            segment->translate(forceVec);
+         for (int i=0; i<count; ++i) {
+            forceVec = (center - layout.position(i)) * 0.05 * (10-pass);
+            layout.translate(i, forceVec);
          }
       }
 
       ++pass;
-   } while (collisions > 0 || pass<10);
+   } while ((collisions > 0 || pass<10) && !integrator.exhausted());
+
+   return integrator.finish([this, &layout, &broadPhase]() {
+      return findCollisions(layout, broadPhase).size();
+   });
+}
+
+int ClusteredArranger::refineLayoutDrop(LayoutState & layout) const {
+   if (layout.isEmpty()) {
+      return 0;
+   }
+
+   // drop the biggest segments first
+   int const count = layout.size();
+   QVector<int> order(count);
+   for (int i=0; i<count; ++i) {
+      order[i] = i;
+   }
+   std::stable_sort(order.begin(), order.end(), [&layout](int a, int b) {
+      return layout.segment(a)->area() > layout.segment(b)->area();
+   });
+
+   // lower and upper silhouette of each segment
+   QVector<QVector<double>> tops(count);
+   QVector<QVector<double>> bottoms(count);
+   QVector<int> lefts(count);
+   int maxWidth = 0;
+   double area = 0.0;
+   for (int i=0; i<count; ++i) {
+      lefts[i] = layout.segment(order.at(i))->silhouette(layout.placement(order.at(i)), tops[i], bottoms[i]);
+      maxWidth = std::max(maxWidth, tops.at(i).size());
+      for (int c=0; c<tops.at(i).size(); ++c) {
+         area += bottoms.at(i).at(c) - tops.at(i).at(c);
+      }
+   }
+
+   // the pile rests on the bottom of the cluster and is about twice as wide as high
+   QRectF const rect = layout.rect();
+   Position const base(qRound(layout.center().x), qRound(rect.bottom()));
+   int const halfWidth = std::max(int(std::ceil(std::sqrt(area))), maxWidth/2 + 1);
+   int const origin = halfWidth + maxWidth;
+   QVector<double> skyline(2*origin + 1, 0.0);
+
+   int left, width;
+   int bestX;
+   double y, bestY, score, bestScore;
+   for (int i=0; i<count; ++i) {
+      QVector<double> const & top = tops.at(i);
+      QVector<double> const & bottom = bottoms.at(i);
+      left = lefts.at(i);
+      width = top.size();
+
+      // find the column where the segment comes to rest lowest, close to the middle
+      bestX = 0;
+      bestY = 0.0;
+      bestScore = -std::numeric_limits<double>::max();
+      for (int x=-halfWidth-left; x+left+width-1<=halfWidth; ++x) {
+         y = std::numeric_limits<double>::max();
+         for (int c=0; c<width; ++c) {
+            y = std::min(y, skyline.at(origin+x+left+c) - bottom.at(c));
+         }
+         score = y - 0.5*std::abs(x);
+         if (score > bestScore) {
+            bestScore = score;
+            bestX = x;
+            bestY = y;
+         }
+      }
+
+      // place it and raise the skyline
+      layout.setPosition(order.at(i), base + Position(bestX, bestY));
+      for (int c=0; c<width; ++c) {
+         skyline[origin+bestX+left+c] = std::min(skyline.at(origin+bestX+left+c), bestY + top.at(c));
+      }
+   }
+
+   // the columns are only pixel wide, so rotated contours may still overlap a little
+   BroadPhase broadPhase(layout);
+   int const residual = findCollisions(layout, broadPhase).size();
+   TIDY_COUNT(ResidualCollisions, residual);
+   return residual;
 }
 
-void ClusteredArranger::refineLayoutPiles(SegmentList & segments) const {
-   int const count = segments.size();
+int ClusteredArranger::refineLayoutPiles(LayoutState & layout, RefineBudget const & budget) const {
+   int const count = layout.size();
    std::unique_ptr<Position[]> forces(new Position[count]);
+   BroadPhase broadPhase(layout);
+   LayoutIntegrator integrator(layout, budget);
    int collisions;
    Position forceVec;
    int pass = 0;
    int const maxPass = 20;
 
    // rotate (align horizontal)
-   foreach (Segment * const segment, segments) {
-      segment->setAngle(0.0);
+   for (int i=0; i<count; ++i) {
+      layout.setAngle(i, 0.0);
    }
 
    do {
@@ -444,33 +579,47 @@ void ClusteredArranger::refineLayoutPiles(SegmentList & segments) const {
       }
 
       // find collisions
-      for (int i=0; i<count-1; ++i) {
-         for (int j=i+1; j<count; ++j) {
-            if (segments.at(i)->collides(segments.at(j))) {
-               // calculate force
-               forceVec = (segments.at(i)->position() - segments.at(j)->position()).normalized() * 2.0;
-               forces[i] += forceVec * Position(0.1, 1.0);
-               forces[j] -= forceVec * Position(0.1, 1.0);
-               ++collisions;
-            }
-         }
+      foreach (Contact const & contact, findCollisions(layout, broadPhase)) {
+         int const i = contact.first;
+         int const j = contact.second;
+         // calculate force
+         forceVec = contact.normal * std::max(2.0, contact.depth*0.5);
+         forces[i] += forceVec * Position(0.1, 1.0);
+         forces[j] -= forceVec * Position(0.1, 1.0);
+         ++collisions;
       }
 
       // apply forces
-      for (int i=0; i<count; ++i) {
-         segments[i]->translate(forces[i]);
-      }
+      integrator.step(forces.get(), nullptr, collisions, pass >= maxPass);
 
       // make it more compact
-      Position center = segments.topCenter();
+      Position center = layout.topCenter();
       if (pass < maxPass) {
-         foreach (Segment * const segment, segments) {
-            forceVec = Position((center.x - segment->position().x) * 0.9 * (maxPass-pass)/double(maxPass),
-                                (center.y - segment->position().y) * 0.05 * (maxPass-pass)/double(maxPass));
-            segment->translate(forceVec);
+         for (int i=0; i<count; ++i) {
+            forceVec = Position((center.x - layout.position(i).x) * 0.9 * (maxPass-pass)/double(maxPass),
+                                (center.y - layout.position(i).y) * 0.05 * (maxPass-pass)/double(maxPass));
+            layout.translate(i, forceVec);
          }
       }
 
       ++pass;
-   } while (collisions > 0 || pass<maxPass);
+   } while ((collisions > 0 || pass<maxPass) && !integrator.exhausted());
+
+   return integrator.finish([this, &layout, &broadPhase]() {
+      return findCollisions(layout, broadPhase).size();
+   });
+}
+
+bool ClusteredArranger::setParameter(QString const & key, QString const & value) {
+   if (key == "shape") {
+      QStringList shapes;
+      shapes << "circles" << "piles" << "drop";
+      int const shape = shapes.indexOf(value.toLower());
+      if (shape < 0) {
+         return false;
+      }
+      parameters.shape = shape;
+      return true;
+   }
+   return setArrangerParameter(parameters, key, value);
 }
@@ -3,30 +3,34 @@
 
 #include "arranger.h"
 
-class QComboBox;
+struct ClusteredParameters : ArrangerParameters {
+   int shape = 0;
+};
 
 class ClusteredArranger : public Arranger {
 
 public:
    ClusteredArranger();
-   virtual QGraphicsScene * arrange(SegmentList const & segments) const;
+   virtual Arrangement arrange(SegmentList const & segments) const;
    virtual void arrangeBatch(SegmentList const & segments, QString const & name) const;
+   virtual bool setParameter(QString const & key, QString const & value);
 
 private:
-   QComboBox * xAxisBox;
-   QComboBox * yAxisBox;
-   QComboBox * clusterBox;
-
-   QList<SegmentList> meanShift(SegmentList const & segments) const;
-   void refineLayoutCircles(SegmentList & segments) const;
-   void refineLayoutPiles(SegmentList & segments) const;
-   void refineLayoutBySize(QList<SegmentList> & clusters) const;
-   void refineLayoutByPlace(QList<SegmentList> & clusters) const;
-
-   void populateSettingsLayout();
-   double minDist(SegmentList const & listA, SegmentList const & listB) const;
-   static bool biggerThan(SegmentList const & listA, SegmentList const & listB);
-   static bool biggerAreaThan(SegmentList const & listA, SegmentList const & listB);
+   ClusteredParameters parameters;
+
+   QList<QVector<int>> meanShift(LayoutState const & layout) const;
+   int refineClusters(QList<LayoutState> & clusters, int shape,
+                      RefineBudget const & budget) const;
+   int refineLayoutCircles(LayoutState & layout, RefineBudget const & budget) const;
+   int refineLayoutDrop(LayoutState & layout) const;
+   int refineLayoutPiles(LayoutState & layout, RefineBudget const & budget) const;
+   void refineLayoutBySize(QList<LayoutState> & clusters) const;
+   void refineLayoutByPlace(QList<LayoutState> & clusters, RefineBudget const & budget) const;
+
+   virtual void populateSettingsLayout();
+   static bool biggerThan(QVector<int> const & listA, QVector<int> const & listB);
+   static bool biggerAreaThan(LayoutState const & layoutA, LayoutState const & layoutB);
+   static int findRoot(QVector<int> & ids, int i);
 };
 
 #endif // CLUSTEREDARRANGER_H
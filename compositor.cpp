@@ -0,0 +1,105 @@
+#include "compositor.h"
+#include <algorithm>
+#include <cmath>
+#include <QtConcurrent>
+#include "layoutstate.h"
+#include "segment.h"
+#include "trace.h"
+
+Compositor::Compositor(LayoutState const & layout) :
+   layout(layout), canvas(layout.rect().toAlignedRect()),
+   sprites(layout.size()), toSprite(layout.size()), bounds(layout.size())
+{
+   // the sprites and their placement on the canvas
+   for (int i=0; i<layout.size(); ++i) {
+      sprites[i] = layout.segment(i)->toQImage();
+      toSprite[i] = layout.segment(i)->spriteTransform(layout.placement(i)).inverted();
+      bounds[i] = layout.boundingRect(i).toAlignedRect().adjusted(-1, -1, 1, 1) & canvas;
+   }
+}
+
+QImage Compositor::render(QRgb background) const {
+   TraceSpan const span("Compositor::render");
+   if (canvas.isEmpty()) {
+      return QImage();
+   }
+   QImage image(canvas.width(), canvas.height(), QImage::Format_ARGB32_Premultiplied);
+   image.fill(qPremultiply(background));
+
+   // split the canvas into bands of rows, each band is drawn by one thread
+   int const bandHeight = 32;
+   QVector<int> bands;
+   for (int top=0; top<canvas.height(); top+=bandHeight) {
+      bands << top;
+   }
+   uchar * const bits = image.bits();
+   int const bytesPerLine = image.bytesPerLine();
+   int const height = canvas.height();
+   QtConcurrent::blockingMap(bands, [this, bits, bytesPerLine, bandHeight, height](int const & top) {
+      renderRows(bits, bytesPerLine, top, std::min(top+bandHeight, height));
+   });
+
+   return image;
+}
+
+void Compositor::renderRows(uchar * bits, int bytesPerLine, int top, int bottom) const {
+   QPointF point;
+   QRgb src;
+   QRgb * dst;
+   int alpha;
+
+   // draw the segments in layout order (later ones on top)
+   for (int i=0; i<layout.size(); ++i) {
+      QRect const rect = bounds.at(i).translated(-canvas.topLeft());
+      QImage const & sprite = sprites.at(i);
+      for (int y=std::max(top, rect.top()); y<std::min(bottom, rect.bottom()+1); ++y) {
+         QRgb * const line = reinterpret_cast<QRgb *>(bits + y*bytesPerLine);
+         for (int x=rect.left(); x<=rect.right(); ++x) {
+            point = toSprite.at(i).map(QPointF(canvas.left() + x + 0.5, canvas.top() + y + 0.5));
+            if (point.x() <= -0.5 || point.y() <= -0.5 ||
+                point.x() >= sprite.width() + 0.5 || point.y() >= sprite.height() + 0.5) {
+               continue;
+            }
+            src = sample(sprite, point.x(), point.y());
+            alpha = qAlpha(src);
+            if (alpha == 0) {
+               continue;
+            }
+
+            // source over, both premultiplied
+            dst = line + x;
+            *dst = qRgba(qRed(src) + qRed(*dst)*(255-alpha)/255,
+                         qGreen(src) + qGreen(*dst)*(255-alpha)/255,
+                         qBlue(src) + qBlue(*dst)*(255-alpha)/255,
+                         alpha + qAlpha(*dst)*(255-alpha)/255);
+         }
+      }
+   }
+}
+
+QRgb Compositor::sample(QImage const & sprite, double u, double v) {
+   // bilinear interpolation between the texel centers (transparent outside)
+   u -= 0.5;
+   v -= 0.5;
+   int const x0 = int(std::floor(u));
+   int const y0 = int(std::floor(v));
+   double const fx = u - x0;
+   double const fy = v - y0;
+   double channels[4]{0.0, 0.0, 0.0, 0.0};
+   double weight;
+   QRgb texel;
+   for (int dy=0; dy<2; ++dy) {
+      if (y0+dy < 0 || y0+dy >= sprite.height()) continue;
+      QRgb const * const line = reinterpret_cast<QRgb const *>(sprite.constScanLine(y0+dy));
+      for (int dx=0; dx<2; ++dx) {
+         if (x0+dx < 0 || x0+dx >= sprite.width()) continue;
+         weight = (dx ? fx : 1.0-fx) * (dy ? fy : 1.0-fy);
+         texel = line[x0+dx];
+         channels[0] += qRed(texel) * weight;
+         channels[1] += qGreen(texel) * weight;
+         channels[2] += qBlue(texel) * weight;
+         channels[3] += qAlpha(texel) * weight;
+      }
+   }
+   return qRgba(qRound(channels[0]), qRound(channels[1]), qRound(channels[2]), qRound(channels[3]));
+}
@@ -0,0 +1,29 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <QImage>
+#include <QRect>
+#include <QTransform>
+#include <QVector>
+
+class LayoutState;
+
+class Compositor {
+
+public:
+   explicit Compositor(LayoutState const & layout);
+
+   QImage render(QRgb background) const;
+
+private:
+   LayoutState const & layout;
+   QRect canvas;
+   QVector<QImage> sprites;
+   QVector<QTransform> toSprite;
+   QVector<QRect> bounds;
+
+   void renderRows(uchar * bits, int bytesPerLine, int top, int bottom) const;
+   static QRgb sample(QImage const & sprite, double u, double v);
+};
+
+#endif // COMPOSITOR_H
@@ -1,10 +1,13 @@
 #include "decomposer.h"
 #include <QFormLayout>
+#include "runcontrol.h"
 #include "segment.h"
 #include "segmentlist.h"
+#include "stats.h"
+#include "trace.h"
 
 Decomposer::Decomposer(QString const & name) :
-   name(name), settingsLayout(new QFormLayout())
+   name(name), settingsLayout(nullptr), artifacts(nullptr), control(nullptr)
 {
 }
 
@@ -12,17 +15,45 @@ Decomposer::~Decomposer() {
    delete settingsLayout;
 }
 
+void Decomposer::advance(int steps) const {
+   if (control) {
+      control->advance(steps);
+   }
+}
+
+void Decomposer::beginStage(QString const & stage, int maximum) const {
+   // the progress stages are also where the memory of a run is sampled
+   TIDY_STAGE(stage);
+   if (control) {
+      control->setStage(stage, maximum);
+   }
+}
+
+bool Decomposer::canceled() const {
+   return control && control->isCanceled();
+}
+
+bool Decomposer::debugArtifacts() const {
+   // intermediate images are only worth building when they are written
+   return artifacts && artifacts->accepts(ArtifactSink::Debug);
+}
+
 QString Decomposer::getName() const {
    return name;
 }
 
-QLayout * Decomposer::getSettingsLayout() const {
+QLayout * Decomposer::getSettingsLayout() {
+   // the widgets are only created for the gui, they just edit the parameters
+   if (!settingsLayout) {
+      settingsLayout = new QFormLayout();
+      populateSettingsLayout();
+   }
    return settingsLayout;
 }
 
 void Decomposer::merge(QList<QPair<Segment *, Segment *>> & mergelist, SegmentList & segments) const {
    QPair<Segment *, Segment *> pair;
-   while (!mergelist.isEmpty()) {
+   while (!mergelist.isEmpty() && !canceled()) {
       pair = mergelist.takeFirst();
       if (pair.first != pair.second) {
          // replace merged segment in the rest of the merge list
@@ -38,10 +69,24 @@ void Decomposer::merge(QList<QPair<Segment *, Segment *>> & mergelist, SegmentLi
          pair.first->merge(pair.second);
          segments.removeAll(pair.second);
          delete pair.second;
+         TIDY_COUNT(Merges, 1);
       }
    }
 }
 
+void Decomposer::mergeSegments(SegmentList & segments, double epsilonMerge, int minSize) const {
+   TraceSpan const span("Decomposer::mergeSegments");
+   // merging may create new small or similiar neighbours, so repeat until nothing changes
+   beginStage(QObject::tr("Merging segments"));
+   int oldSegmentsSize;
+   do {
+      oldSegmentsSize = segments.size();
+      TIDY_COUNT(MergeRounds, 1);
+      mergeSimiliarSegments(segments, epsilonMerge*epsilonMerge);
+      mergeSmallSegments(segments, minSize);
+   } while (segments.size() != oldSegmentsSize && !canceled());
+}
+
 void Decomposer::mergeSimiliarSegments(SegmentList & segments, double epsSquared) const {
    // find couples to merge
    QList<QPair<Segment *, Segment *>> mergelist;
@@ -80,3 +125,37 @@ void Decomposer::mergeSmallSegments(SegmentList & segments, int minSize) const{
    // merge couples
    merge(mergelist, segments);
 }
+
+void Decomposer::parametersChanged() const {
+   if (changeListener) {
+      changeListener();
+   }
+}
+
+void Decomposer::saveDebug(ImageColor const & image, QString const & filename) const {
+   if (artifacts) {
+      artifacts->write(ArtifactSink::Debug, image, filename);
+   }
+}
+
+void Decomposer::saveDebug(ImageGray const & image, QString const & filename) const {
+   if (artifacts) {
+      artifacts->write(ArtifactSink::Debug, image, filename);
+   }
+}
+
+void Decomposer::setArtifactSink(ArtifactSink * sink) {
+   artifacts = sink;
+}
+
+void Decomposer::setChangeListener(std::function<void()> const & listener) {
+   changeListener = listener;
+}
+
+void Decomposer::setRunControl(RunControl * control) {
+   this->control = control;
+}
+
+void Decomposer::setStageCacheMegaBytes(int maxMegaBytes) {
+   stageCache.setMaxMegaBytes(maxMegaBytes);
+}
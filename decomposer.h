@@ -1,11 +1,15 @@
 #ifndef DECOMPOSER_H
 #define DECOMPOSER_H
 
+#include <functional>
 #include <QList>
+#include "artifactsink.h"
 #include "image.forward.h"
+#include "stagecache.h"
 
 class QLayout;
 class QFormLayout;
+class RunControl;
 class Segment;
 class SegmentList;
 
@@ -16,14 +20,39 @@ public:
    virtual ~Decomposer();
    virtual SegmentList decompose(ImageColor const & image) const = 0;
    virtual SegmentList decomposeBatch(ImageColor const & image, QString const & name) const = 0;
+   // takes the parameters on the calling thread, the task may run on a worker
+   // while the settings are edited, the image has to outlive it
+   virtual std::function<SegmentList()> previewTask(ImageColor const & image, double scale) const = 0;
+   virtual bool setParameter(QString const & key, QString const & value) = 0;
+   virtual QString parameterKey() const = 0;
    QString getName() const;
-   QLayout * getSettingsLayout() const;
+   QLayout * getSettingsLayout();
+   void setArtifactSink(ArtifactSink * sink);
+   void setChangeListener(std::function<void()> const & listener);
+   void setRunControl(RunControl * control);
+   void setStageCacheMegaBytes(int maxMegaBytes);
 
 protected:
    QString name;
 
    QFormLayout * settingsLayout;
-
+   ArtifactSink * artifacts;
+   RunControl * control;
+   std::function<void()> changeListener;
+   // intermediate results of the last runs, a parameter change only recomputes later stages
+   mutable StageCache stageCache;
+
+   virtual void populateSettingsLayout() = 0;
+
+   void advance(int steps = 1) const;
+   void beginStage(QString const & stage, int maximum = 0) const;
+   bool canceled() const;
+   bool debugArtifacts() const;
+   void parametersChanged() const;
+   void saveDebug(ImageColor const & image, QString const & filename) const;
+   void saveDebug(ImageGray const & image, QString const & filename) const;
+
+   void mergeSegments(SegmentList & segments, double epsilonMerge, int minSize) const;
    void mergeSimiliarSegments(SegmentList & segments, double epsSquared = 1.0) const;
    void mergeSmallSegments(SegmentList & segments, int minSize = 10) const;
    void merge(QList<QPair<Segment *, Segment *>> & mergelist, SegmentList & segments) const;
@@ -0,0 +1,102 @@
+#include "distancefield.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+DistanceField::DistanceField() :
+   _width(0), _height(0)
+{
+}
+
+DistanceField::DistanceField(int width, int height, QVector<bool> const & inside) :
+   _width(width), _height(height), _data(width*height)
+{
+   QVector<float> const toInside = chamfer(width, height, inside, true);
+   QVector<float> const toOutside = chamfer(width, height, inside, false);
+
+   // signed distance to the boundary between the pixel centers (negative inside)
+   for (int i=0; i<_data.size(); ++i) {
+      _data[i] = inside.at(i) ? 0.5f - toOutside.at(i) : toInside.at(i) - 0.5f;
+   }
+}
+
+float DistanceField::at(int x, int y) const {
+   return _data.at(y*_width + x);
+}
+
+QVector<float> DistanceField::chamfer(int width, int height, QVector<bool> const & feature, bool value) {
+   float const infinity = 1e30f;
+   float const diagonal = 1.41421356f;
+   QVector<float> dist(width*height);
+   for (int i=0; i<dist.size(); ++i) {
+      dist[i] = feature.at(i)==value ? 0.0f : infinity;
+   }
+
+   // forward pass
+   for (int y=0; y<height; ++y) {
+      for (int x=0; x<width; ++x) {
+         float & d = dist[y*width + x];
+         if (x > 0) d = std::min(d, dist.at(y*width + x-1) + 1.0f);
+         if (y > 0) {
+            d = std::min(d, dist.at((y-1)*width + x) + 1.0f);
+            if (x > 0) d = std::min(d, dist.at((y-1)*width + x-1) + diagonal);
+            if (x < width-1) d = std::min(d, dist.at((y-1)*width + x+1) + diagonal);
+         }
+      }
+   }
+
+   // backward pass
+   for (int y=height-1; y>=0; --y) {
+      for (int x=width-1; x>=0; --x) {
+         float & d = dist[y*width + x];
+         if (x < width-1) d = std::min(d, dist.at(y*width + x+1) + 1.0f);
+         if (y < height-1) {
+            d = std::min(d, dist.at((y+1)*width + x) + 1.0f);
+            if (x > 0) d = std::min(d, dist.at((y+1)*width + x-1) + diagonal);
+            if (x < width-1) d = std::min(d, dist.at((y+1)*width + x+1) + diagonal);
+         }
+      }
+   }
+
+   return dist;
+}
+
+Position DistanceField::gradient(Position const & pos) const {
+   double const x = qBound(0.0, double(pos.x), _width-1.0);
+   double const y = qBound(0.0, double(pos.y), _height-1.0);
+   return Position((interpolate(x+0.5, y) - interpolate(x-0.5, y)),
+                   (interpolate(x, y+0.5) - interpolate(x, y-0.5)));
+}
+
+int DistanceField::height() const {
+   return _height;
+}
+
+double DistanceField::interpolate(double x, double y) const {
+   x = qBound(0.0, x, _width-1.0);
+   y = qBound(0.0, y, _height-1.0);
+   int const x0 = int(x);
+   int const y0 = int(y);
+   int const x1 = std::min(x0+1, _width-1);
+   int const y1 = std::min(y0+1, _height-1);
+   double const fx = x - x0;
+   double const fy = y - y0;
+   return (at(x0, y0)*(1.0-fx) + at(x1, y0)*fx) * (1.0-fy) +
+          (at(x0, y1)*(1.0-fx) + at(x1, y1)*fx) * fy;
+}
+
+bool DistanceField::isNull() const {
+   return _width == 0 || _height == 0;
+}
+
+double DistanceField::sample(Position const & pos) const {
+   // everything beyond the field is far outside
+   if (isNull() || pos.x < 0.0f || pos.y < 0.0f || pos.x > _width-1 || pos.y > _height-1) {
+      return std::numeric_limits<double>::max();
+   }
+   return interpolate(pos.x, pos.y);
+}
+
+int DistanceField::width() const {
+   return _width;
+}
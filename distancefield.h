@@ -0,0 +1,30 @@
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include <QVector>
+#include "pixel.h"
+
+class DistanceField {
+
+public:
+   DistanceField();
+   DistanceField(int width, int height, QVector<bool> const & inside);
+
+   bool isNull() const;
+   int width() const;
+   int height() const;
+   float at(int x, int y) const;
+
+   double sample(Position const & pos) const;
+   Position gradient(Position const & pos) const;
+
+private:
+   int _width;
+   int _height;
+   QVector<float> _data;
+
+   double interpolate(double x, double y) const;
+   static QVector<float> chamfer(int width, int height, QVector<bool> const & feature, bool value);
+};
+
+#endif // DISTANCEFIELD_H
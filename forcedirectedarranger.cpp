@@ -1,61 +1,79 @@
 #include "forcedirectedarranger.h"
 #include <memory>
 #include <QCheckBox>
-#include <QComboBox>
 #include <QDir>
 #include <QFile>
 #include <QFormLayout>
-#include <QGraphicsScene>
 #include <QTextStream>
+#include "broadphase.h"
+#include "layoutstate.h"
 #include "segment.h"
 #include "segmentlist.h"
+#include "trace.h"
 
 #include <QTime>
 
 ForceDirectedArranger::ForceDirectedArranger() :
-   Arranger("Force directed arranger")
+   Arranger("Force directed arranger"), lastFeatX(-1), lastFeatY(-1)
 {
-   populateSettingsLayout();
 }
 
-QGraphicsScene * ForceDirectedArranger::arrange(SegmentList const & segments) const {
-   QGraphicsScene * arrangement = new QGraphicsScene();
-
-   QTime time;
-   time.start();
+Arrangement ForceDirectedArranger::arrange(SegmentList const & segments) const {
+   ForceDirectedParameters const params = parameters;
+   RefineBudget const budget = refineBudget(params);
+   TraceSpan const span("ForceDirectedArranger::arrange");
 
    // determine background
    Segment * background = determineBackground(segments);
    SegmentList segmentsWOBack = removeBackground(segments, background);
-   arrangement->setBackgroundBrush(QBrush(QColor(background->color().toQRgb())));
    segmentsWOBack.calculateFeatureVariances();
 
-   // initialize layout
-   //initializeLayout(segmentsWOBack, segmentsWOBack.featX(), segmentsWOBack.featY());
-   initializeLayout(segmentsWOBack, xAxisBox->currentIndex(), yAxisBox->currentIndex());
+   // initialize layout (or continue from the last converged one of the same segments)
+   int const featX = params.xAxis;
+   int const featY = params.yAxis;
+   LayoutState layout(segmentsWOBack);
+   QVector<quint64> const ids = segmentIds(segmentsWOBack);
+   bool const warmStarted = params.warmStart && lastFeatX >= 0 && lastSegmentIds == ids;
+   if (warmStarted) {
+      layout = lastLayout;
+      warmStartLayout(layout, lastFeatX, lastFeatY, featX, featY);
+   }
+   else {
+      //initializeLayout(layout, segmentsWOBack.featX(), segmentsWOBack.featY());
+      initializeLayout(layout, featX, featY);
+   }
 
    // refine layout
-   time.restart();
-   if (rotationCB->isChecked()) {
-      refineLayoutWRotate(segmentsWOBack);
+   int residual;
+   if (params.rotation) {
+      residual = refineLayoutWRotate(layout, budget, warmStarted);
    }
    else {
-      refineLayoutSimple(segmentsWOBack);
+      residual = refineLayoutSimple(layout, budget, warmStarted);
    }
-   qDebug("Arrangement refined in %f seconds", time.restart()/1000.0);
+   qDebug("  Residual collisions: %d", residual);
 
-   // convert the segments to QGraphicsItems and add to QGraphicsScene
-   foreach(Segment const * const segment, segmentsWOBack) {
-      arrangement->addItem(segment->toQGraphicsItem());
-      // without the following line QPainter tends to crash
-      arrangement->width();
+   // remember converged layouts as seeds for the next run
+   if (residual == 0) {
+      lastLayout = layout;
+      lastSegmentIds = ids;
+      lastFeatX = featX;
+      lastFeatY = featY;
+   }
+   else {
+      lastLayout = LayoutState();
+      lastSegmentIds.clear();
+      lastFeatX = lastFeatY = -1;
    }
-   saveScene(arrangement, "FD3_post.png");
 
-   return arrangement;
+   saveLayout(layout, background->color().toQRgb(), "FD3_post.png", ArtifactSink::Debug);
+
+   // the scene is built in the gui thread
+   return Arrangement{layout, background->color().toQRgb()};
 }
 
 void ForceDirectedArranger::arrangeBatch(SegmentList const & segments, QString const & name) const {
+   TraceSpan const span("ForceDirectedArranger::arrangeBatch");
    QDir dir;
    dir.mkpath(name + "/ForceDirectedArranger");
 
@@ -63,9 +81,6 @@ void ForceDirectedArranger::arrangeBatch(SegmentList const & segments, QString c
    file.open(QFile::WriteOnly | QFile::Truncate);
    QTextStream out(&file);
 
-   QTime time;
-   time.start();
-
    // determine background
    Segment * background = determineBackground(segments);
    SegmentList segmentsWOBack = removeBackground(segments, background);
@@ -75,69 +90,107 @@ void ForceDirectedArranger::arrangeBatch(SegmentList const & segments, QString c
    out << "   y = " << FeatureVector::toString(segmentsWOBack.featY()) << endl;
    out << endl;
 
-   for (int i=0; i<9; ++i) {
-      for (int j=i+1; j<10; ++j) {
-         out << "Arrangement:" << endl;
-         out << "   x = " << FeatureVector::toString(i) << endl;
-         out << "   y = " << FeatureVector::toString(j) << endl;
-         QGraphicsScene * arrangement = new QGraphicsScene();
-         arrangement->setBackgroundBrush(QBrush(QColor(background->color().toQRgb())));
-
-         // initialize layout
-         initializeLayout(segmentsWOBack, i, j);
-         segmentsWOBack.resetAngles();
-
-         // refine layout
-         time.restart();
-         if (i!= ANGLE && j != ANGLE) {
-            refineLayoutWRotate(segmentsWOBack);
-         }
-         else {
-            refineLayoutSimple(segmentsWOBack);
-         }
-         out << "   Arrangement refined in " << time.elapsed()/1000.0 << " seconds" << endl;
+   // arrange the feature pairs concurrently, each on its own layout
+   ForceDirectedParameters const params = parameters;
+   RefineBudget const budget = refineBudget(params);
+   bool const warmStart = params.warmStart;
+   auto arrangePair = [this, &segmentsWOBack, &budget, warmStart](int i, int j, BatchResult const * previous) {
+      BatchResult result{i, j, QString(), QList<LayoutState>(), 0};
+      QTextStream log(&result.log);
+      log << "Arrangement:" << endl;
+      log << "   x = " << FeatureVector::toString(i) << endl;
+      log << "   y = " << FeatureVector::toString(j) << endl;
 
-         // convert the segments to QGraphicsItems and add to QGraphicsScene
-         foreach(Segment const * const segment, segmentsWOBack) {
-            arrangement->addItem(segment->toQGraphicsItem());
-            // without the following line QPainter tends to crash
-            arrangement->width();
-         }
-         saveScene(arrangement, name +
-                                "/ForceDirectedArranger" +
-                                QString("/%1_%2.png").arg(FeatureVector::toString(i))
-                                                     .arg(FeatureVector::toString(j)));
+      // initialize layout (or continue from the previous pair with the same x axis, if
+      // that one converged)
+      LayoutState layout(segmentsWOBack);
+      bool const warmStarted = warmStart && previous && previous->residual == 0;
+      if (warmStarted) {
+         layout = previous->layouts.first();
+         warmStartLayout(layout, previous->featX, previous->featY, i, j);
+      }
+      else {
+         initializeLayout(layout, i, j);
+      }
 
-         delete arrangement;
-         out << endl;
+      // refine layout
+      QTime time;
+      time.start();
+      RefineBudget pairBudget = budget;
+      pairBudget.restart();
+      int residual;
+      if (i!= ANGLE && j != ANGLE) {
+         residual = refineLayoutWRotate(layout, pairBudget, warmStarted);
       }
-   }
+      else {
+         layout.resetAngles();
+         residual = refineLayoutSimple(layout, pairBudget, warmStarted);
+      }
+      log << "   Arrangement refined in " << time.elapsed()/1000.0 << " seconds" << endl;
+      log << "   Residual collisions: " << residual << endl;
+      log << endl;
+      log.flush();
+
+      result.layouts << layout;
+      result.residual = residual;
+      return result;
+   };
+
+   // write the results in order
+   auto finishPair = [this, &out, &name, background](BatchResult const & result) {
+      out << result.log;
+
+      // composite the layout without going through a QGraphicsScene
+      saveLayout(result.layouts.first(), background->color().toQRgb(),
+                 name + "/ForceDirectedArranger" +
+                 QString("/%1_%2.png").arg(FeatureVector::toString(result.featX))
+                                      .arg(FeatureVector::toString(result.featY)));
+   };
+
+   sweepFeaturePairs(arrangePair, finishPair, warmStart);
 
    file.close();
 }
 
-void ForceDirectedArranger::populateSettingsLayout() {
-   xAxisBox = new QComboBox();
-   for (int i=0; i<10; ++i) {
-      xAxisBox->insertItem(i, FeatureVector::toString(i));
-   }
-   settingsLayout->addRow(QObject::tr("x axis"), xAxisBox);
+void ForceDirectedArranger::forgetSegments() {
+   // the layout points to the segments, they are about to be deleted
+   lastLayout = LayoutState();
+   lastSegmentIds.clear();
+   lastFeatX = lastFeatY = -1;
+}
 
-   yAxisBox = new QComboBox();
-   for (int i=0; i<10; ++i) {
-      yAxisBox->insertItem(i, FeatureVector::toString(i));
-   }
-   yAxisBox->setCurrentIndex(1);
-   settingsLayout->addRow(QObject::tr("y axis"), yAxisBox);
+void ForceDirectedArranger::populateSettingsLayout() {
+   populateAxisSettings(parameters);
 
-   rotationCB = new QCheckBox("allow");
-   rotationCB->setChecked(true);
+   QCheckBox * rotationCB = new QCheckBox("allow");
+   rotationCB->setChecked(parameters.rotation);
+   QObject::connect(rotationCB, &QCheckBox::toggled,
+                    [this](bool checked) { parameters.rotation = checked; });
    settingsLayout->addRow(QObject::tr("Rotation"), rotationCB);
+
+   QCheckBox * warmStartCB = new QCheckBox("continue last layout");
+   warmStartCB->setChecked(parameters.warmStart);
+   warmStartCB->setToolTip(QObject::tr("Start from the last converged layout and only move along the changed axis"));
+   QObject::connect(warmStartCB, &QCheckBox::toggled,
+                    [this](bool checked) { parameters.warmStart = checked; });
+   settingsLayout->addRow(QObject::tr("Warm start"), warmStartCB);
+
+   populateBudgetSettings(parameters);
 }
 
-void ForceDirectedArranger::refineLayoutSimple(SegmentList & segments) const {
-   int const count = segments.size();
+int ForceDirectedArranger::refineLayoutSimple(LayoutState & layout, RefineBudget const & budget,
+                                              bool warmStarted) const {
+   TraceSpan const span("ForceDirectedArranger::refineLayoutSimple");
+   int const count = layout.size();
    std::unique_ptr<Position[]> forces(new Position[count]);
+   BroadPhase broadPhase(layout);
+   LayoutIntegrator integrator(layout, budget);
+
+   // resolve the coarse overlaps cheaply before testing the contours (a warm started
+   // layout is already separated, circles around elongated segments would only push it apart)
+   if (!warmStarted) {
+      separateCircles(layout, budget);
+   }
    int collisions;
    Position forceVec;
 
@@ -146,66 +199,99 @@ void ForceDirectedArranger::refineLayoutSimple(SegmentList & segments) const {
       for (int i=0; i<count; ++i) {
          forces[i] = Position();
       }
-      for (int i=0; i<count-1; ++i) {
-         for (int j=i+1; j<count; ++j) {
-            if (segments.at(i)->collides(segments.at(j))) {
-               ++collisions;
-               forceVec = (segments.at(i)->position() - segments.at(j)->position()).normalized() * 2.0;
-               forces[i] += forceVec;
-               forces[j] -= forceVec;
-            }
-         }
-      }
-      for (int i=0; i<count; ++i) {
-         segments[i]->translate(forces[i]);
+      foreach (Contact const & contact, findCollisions(layout, broadPhase)) {
+         int const i = contact.first;
+         int const j = contact.second;
+         ++collisions;
+         forceVec = contact.normal * std::max(2.0, contact.depth*0.5);
+         forces[i] += forceVec;
+         forces[j] -= forceVec;
       }
-   } while (collisions > 0);
+      integrator.step(forces.get(), nullptr, collisions);
+   } while (collisions > 0 && !integrator.exhausted());
+
+   return integrator.finish([this, &layout, &broadPhase]() {
+      return findCollisions(layout, broadPhase).size();
+   });
 }
 
-void ForceDirectedArranger::refineLayoutWRotate(SegmentList & segments) const {
-   int const count = segments.size();
+int ForceDirectedArranger::refineLayoutWRotate(LayoutState & layout, RefineBudget const & budget,
+                                               bool warmStarted) const {
+   TraceSpan const span("ForceDirectedArranger::refineLayoutWRotate");
+   int const count = layout.size();
    std::unique_ptr<Position[]> forces(new Position[count]);
    std::unique_ptr<double[]> angles(new double[count]);
+   BroadPhase broadPhase(layout);
+   LayoutIntegrator integrator(layout, budget);
+
+   // resolve the coarse overlaps cheaply before testing the contours (a warm started
+   // layout is already separated, circles around elongated segments would only push it apart)
+   if (!warmStarted) {
+      separateCircles(layout, budget);
+   }
    int collisions;
    Position forceVec;
    double alpha;
-   int counter = 0;
    do {
       collisions = 0;
       for (int i=0; i<count; ++i) {
          forces[i] = Position();
          angles[i] = 0.0;
       }
-      for (int i=0; i<count-1; ++i) {
-         for (int j=i+1; j<count; ++j) {
-            if (segments.at(i)->collides(segments.at(j))) {
-               ++collisions;
-               // calculate forces
-               forceVec = (segments.at(i)->position() - segments.at(j)->position()).normalized() * 2.0;
-               forces[i] += forceVec;
-               forces[j] -= forceVec;
-
-               // calculate the angle of an orthogonal vector of the force vector
-               alpha = atan(-forceVec.x/forceVec.y);
-               if (segments.at(i)->angle() < alpha) {
-                  angles[i] += 0.2;
-               }
-               else if (segments.at(i)->angle() > alpha) {
-                  angles[i] -= 0.2;
-               }
-               if (segments.at(j)->angle() < alpha) {
-                  angles[j] += 0.2;
-               }
-               else if (segments.at(j)->angle() > alpha) {
-                  angles[j] -= 0.2;
-               }
-            }
+      foreach (Contact const & contact, findCollisions(layout, broadPhase)) {
+         int const i = contact.first;
+         int const j = contact.second;
+         ++collisions;
+         // calculate forces
+         forceVec = contact.normal * std::max(2.0, contact.depth*0.5);
+         forces[i] += forceVec;
+         forces[j] -= forceVec;
+
+         // calculate the angle of an orthogonal vector of the force vector
+         alpha = atan(-forceVec.x/forceVec.y);
+         if (layout.angle(i) < alpha) {
+            angles[i] += 0.2;
+         }
+         else if (layout.angle(i) > alpha) {
+            angles[i] -= 0.2;
+         }
+         if (layout.angle(j) < alpha) {
+            angles[j] += 0.2;
+         }
+         else if (layout.angle(j) > alpha) {
+            angles[j] -= 0.2;
          }
       }
-      for (int i=0; i<count; ++i) {
-         segments[i]->translate(forces[i]);
-         segments[i]->rotate(angles[i]);
+      integrator.step(forces.get(), angles.get(), collisions);
+   } while (collisions > 0 && !integrator.exhausted());
+
+   return integrator.finish([this, &layout, &broadPhase]() {
+      return findCollisions(layout, broadPhase).size();
+   });
+}
+
+QVector<quint64> ForceDirectedArranger::segmentIds(SegmentList const & segments) {
+   QVector<quint64> ids;
+   ids.reserve(segments.size());
+   foreach (Segment const * const segment, segments) {
+      ids << segment->id();
+   }
+   return ids;
+}
+
+bool ForceDirectedArranger::setParameter(QString const & key, QString const & value) {
+   if (key == "rotation" || key == "warmStart") {
+      bool const enabled = value == "1" || value.compare("true", Qt::CaseInsensitive) == 0;
+      if (!enabled && value != "0" && value.compare("false", Qt::CaseInsensitive) != 0) {
+         return false;
       }
-      ++counter;
-   } while (collisions > 0);
+      if (key == "rotation") {
+         parameters.rotation = enabled;
+      }
+      else {
+         parameters.warmStart = enabled;
+      }
+      return true;
+   }
+   return setArrangerParameter(parameters, key, value);
 }
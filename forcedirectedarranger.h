@@ -3,24 +3,31 @@
 
 #include "arranger.h"
 
-class QCheckBox;
-class QComboBox;
+struct ForceDirectedParameters : ArrangerParameters {
+   bool rotation = true;
+   bool warmStart = false;
+};
 
 class ForceDirectedArranger : public Arranger {
 
 public:
    ForceDirectedArranger();
-   virtual QGraphicsScene * arrange(SegmentList const & segments) const;
+   virtual Arrangement arrange(SegmentList const & segments) const;
    virtual void arrangeBatch(SegmentList const & segments, QString const & name) const;
+   virtual bool setParameter(QString const & key, QString const & value);
+   virtual void forgetSegments();
 
 private:
-   QComboBox * xAxisBox;
-   QComboBox * yAxisBox;
-   QCheckBox * rotationCB;
+   ForceDirectedParameters parameters;
+   mutable LayoutState lastLayout;
+   mutable QVector<quint64> lastSegmentIds;
+   mutable int lastFeatX;
+   mutable int lastFeatY;
 
-   void populateSettingsLayout();
-   void refineLayoutSimple(SegmentList & segments) const;
-   void refineLayoutWRotate(SegmentList & segments) const;
+   virtual void populateSettingsLayout();
+   static QVector<quint64> segmentIds(SegmentList const & segments);
+   int refineLayoutSimple(LayoutState & layout, RefineBudget const & budget, bool warmStarted) const;
+   int refineLayoutWRotate(LayoutState & layout, RefineBudget const & budget, bool warmStarted) const;
 };
 
 #endif // ARRANGER1_H
@@ -1,8 +1,10 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <algorithm>
 #include <QImage>
 #include "image.forward.h"
+#include "stats.h"
 
 template <typename C>
 class Image {
@@ -17,6 +19,14 @@ public:
       _width(width), _height(height), _data(new C[width*height])
    {
       memset(_data, 0x00, width*height*sizeof(C));
+      TIDY_ALLOCATE(ImageMemory, bytes());
+   }
+
+   Image(Image<C> const & other) :
+      _width(other._width), _height(other._height), _data(new C[other.area()])
+   {
+      std::copy(other._data, other._data + other.area(), _data);
+      TIDY_ALLOCATE(ImageMemory, bytes());
    }
 
    Image(Image<C> && other) :
@@ -25,10 +35,9 @@ public:
       other._data = nullptr;
    }
 
-   explicit Image(QString const & filename) :
+   explicit Image(QImage image) :
       _width(0), _height(0), _data(nullptr)
    {
-      QImage image(filename);
       if (!image.isNull()) {
          if (image.format() != QImage::Format_RGB32) {
             image = image.convertToFormat(QImage::Format_RGB32);
@@ -40,16 +49,26 @@ public:
          for (int i=0; i<area(); ++i) {
             _data[i] = C(*pixel++);
          }
+         TIDY_ALLOCATE(ImageMemory, bytes());
       }
    }
 
+   explicit Image(QString const & filename) :
+      Image(QImage(filename))
+   {
+   }
+
    ~Image() {
+      if (_data) {
+         TIDY_RELEASE(ImageMemory, bytes());
+      }
       delete[] _data;
    }
 
    Image & operator=(Image && other) {
-      _width = other._width;
-      _height = other._height;
+      // the other image frees the old data, so it gets the matching size
+      std::swap(_width, other._width);
+      std::swap(_height, other._height);
       std::swap(_data, other._data);
       return *this;
    }
@@ -75,6 +94,10 @@ public:
       return std::max(_width, _height);
    }
 
+   qint64 bytes() const {
+      return qint64(area())*sizeof(C);
+   }
+
 
    C & at(int x, int y) {
       return _data[y*_width + x];
@@ -0,0 +1,112 @@
+#include "layoutintegrator.h"
+#include <limits>
+#include "layoutstate.h"
+#include "runcontrol.h"
+#include "stats.h"
+
+RefineBudget::RefineBudget(int maxIterations, double maxSeconds, RunControl const * control) :
+   maxIterations(maxIterations), maxMSecs(qRound64(maxSeconds*1000.0)), control(control)
+{
+   timer.start();
+}
+
+bool RefineBudget::exhausted(int iterations) const {
+   // a canceled run ends every refinement like a spent budget
+   return (maxIterations > 0 && iterations >= maxIterations) ||
+          (maxMSecs > 0 && timer.hasExpired(maxMSecs)) ||
+          (control && control->isCanceled());
+}
+
+void RefineBudget::restart() {
+   timer.restart();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+LayoutIntegrator::LayoutIntegrator(LayoutState & layout, RefineBudget const & budget) :
+   layout(layout), budget(budget),
+   velocities(layout.size()), angularVelocities(layout.size(), 0.0),
+   stepSize(1.0), lastCollisions(std::numeric_limits<int>::max()), iteration(0),
+   bestCollisions(std::numeric_limits<int>::max())
+{
+}
+
+bool LayoutIntegrator::exhausted() const {
+   return budget.exhausted(iteration);
+}
+
+int LayoutIntegrator::finish(std::function<int()> const & measure) {
+   TIDY_COUNT(ForceRefinements, 1);
+   TIDY_COUNT(ForceIterations, iteration);
+   TIDY_SAMPLE(ForceIterationsPerRefinement, iteration);
+   // a step without collisions leaves the measured state as it is
+   if (iteration > 0 && lastCollisions == 0) {
+      return 0;
+   }
+
+   // the budget ran out, fall back to the best state measured, the last step
+   // moved the layout past its measurement
+   if (!bestPositions.isEmpty()) {
+      for (int i=0; i<layout.size(); ++i) {
+         layout.setPosition(i, bestPositions.at(i));
+         layout.setRotation(i, bestRotations.at(i));
+      }
+      lastCollisions = bestCollisions;
+   }
+   else {
+      lastCollisions = measure();
+      if (lastCollisions == 0) {
+         return 0;
+      }
+   }
+   TIDY_COUNT(ForceBudgetsExhausted, 1);
+   TIDY_COUNT(ResidualCollisions, lastCollisions);
+   return lastCollisions;
+}
+
+int LayoutIntegrator::iterations() const {
+   return iteration;
+}
+
+void LayoutIntegrator::step(Position const * forces, double const * angles,
+                            int collisions, bool trackBest) {
+   int const count = layout.size();
+   double const momentum = 0.5;
+
+   // remember the best state measured so far
+   if (trackBest && collisions < bestCollisions) {
+      bestCollisions = collisions;
+      bestPositions = layout.positions();
+      bestRotations = layout.rotations();
+   }
+
+   // adapt the step size (grow while the overlap shrinks, back off otherwise)
+   if (collisions < lastCollisions) {
+      stepSize = std::min(stepSize * 1.1, 4.0);
+   }
+   else if (collisions > lastCollisions) {
+      stepSize = std::max(stepSize * 0.5, 0.25);
+      velocities.fill(Position());
+      angularVelocities.fill(0.0);
+   }
+   lastCollisions = collisions;
+
+   // integrate
+   if (collisions > 0) {
+      for (int i=0; i<count; ++i) {
+         velocities[i] = velocities.at(i) * momentum + forces[i] * stepSize;
+         layout.translate(i, velocities.at(i));
+         if (angles) {
+            angularVelocities[i] = angularVelocities.at(i) * momentum + angles[i] * stepSize;
+            layout.rotate(i, angularVelocities.at(i));
+         }
+      }
+   }
+   else {
+      // come to rest
+      velocities.fill(Position());
+      angularVelocities.fill(0.0);
+   }
+
+   ++iteration;
+}
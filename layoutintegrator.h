@@ -0,0 +1,52 @@
+#ifndef LAYOUTINTEGRATOR_H
+#define LAYOUTINTEGRATOR_H
+
+#include <functional>
+#include <QElapsedTimer>
+#include <QVector>
+#include "pixel.h"
+
+class LayoutState;
+class RunControl;
+
+class RefineBudget {
+
+public:
+   explicit RefineBudget(int maxIterations = 0, double maxSeconds = 0.0,
+                         RunControl const * control = nullptr);
+
+   bool exhausted(int iterations) const;
+   void restart();
+
+private:
+   int maxIterations;
+   qint64 maxMSecs;
+   QElapsedTimer timer;
+   RunControl const * control;
+};
+
+class LayoutIntegrator {
+
+public:
+   LayoutIntegrator(LayoutState & layout, RefineBudget const & budget);
+
+   void step(Position const * forces, double const * angles,
+             int collisions, bool trackBest = true);
+   bool exhausted() const;
+   int iterations() const;
+   int finish(std::function<int()> const & measure);
+
+private:
+   LayoutState & layout;
+   RefineBudget const & budget;
+   QVector<Position> velocities;
+   QVector<double> angularVelocities;
+   double stepSize;
+   int lastCollisions;
+   int iteration;
+   int bestCollisions;
+   QVector<Position> bestPositions;
+   QVector<double> bestRotations;
+};
+
+#endif // LAYOUTINTEGRATOR_H
@@ -0,0 +1,190 @@
+#include "layoutstate.h"
+#include <limits>
+#include "segment.h"
+
+LayoutState::LayoutState()
+{
+}
+
+LayoutState::LayoutState(SegmentList const & segments) :
+   _segments(segments), _indices(segments.size()),
+   _positions(segments.size()), _rotations(segments.size(), 0.0),
+   _scales(segments.size(), 0.75),
+   _bounds(segments.size()), _boundsValid(segments.size(), false)
+{
+   // start where the segments are in the image
+   for (int i=0; i<segments.size(); ++i) {
+      _indices[i] = i;
+      _positions[i] = segments.at(i)->origin();
+   }
+}
+
+double LayoutState::angle(int i) const {
+   return _rotations.at(i) + _segments.at(i)->originalAngle();
+}
+
+int LayoutState::area() const {
+   return _segments.area();
+}
+
+void LayoutState::assign(LayoutState const & subset) {
+   int k;
+   for (int i=0; i<subset.size(); ++i) {
+      k = subset._indices.at(i);
+      _positions[k] = subset._positions.at(i);
+      _rotations[k] = subset._rotations.at(i);
+      _scales[k] = subset._scales.at(i);
+      _boundsValid[k] = false;
+   }
+}
+
+Position LayoutState::bottomCenter() const {
+   Position pos(0.0, std::numeric_limits<double>::max());
+   int area = 0;
+
+   for (int i=0; i<size(); ++i) {
+      pos.x += _positions.at(i).x * _segments.at(i)->area();
+      area += _segments.at(i)->area();
+
+      pos.y = std::min(pos.y, _positions.at(i).y);
+   }
+   pos.x /= double(area);
+
+   return pos;
+}
+
+QRectF LayoutState::boundingRect(int i) const {
+   // the rotated bounds are cached until the segment is moved or rotated
+   if (!_boundsValid.at(i)) {
+      _bounds[i] = _segments.at(i)->boundingRect(placement(i));
+      _boundsValid[i] = true;
+   }
+   return _bounds.at(i);
+}
+
+Position LayoutState::center() const {
+   Position pos;
+   int area = 0;
+
+   for (int i=0; i<size(); ++i) {
+      pos += _positions.at(i) * _segments.at(i)->area();
+      area += _segments.at(i)->area();
+   }
+   pos /= double(area);
+
+   return pos;
+}
+
+bool LayoutState::isEmpty() const {
+   return _segments.isEmpty();
+}
+
+Placement LayoutState::placement(int i) const {
+   return Placement{_positions.at(i), _rotations.at(i), _scales.at(i)};
+}
+
+Position const & LayoutState::position(int i) const {
+   return _positions.at(i);
+}
+
+QVector<Position> const & LayoutState::positions() const {
+   return _positions;
+}
+
+QRectF LayoutState::rect() const {
+   QRectF rect;
+   for (int i=0; i<size(); ++i) {
+      rect |= boundingRect(i);
+   }
+   return rect;
+}
+
+void LayoutState::resetAngles() {
+   _rotations.fill(0.0);
+   _boundsValid.fill(false);
+}
+
+void LayoutState::rotate(int i, double alpha) {
+   _rotations[i] += alpha;
+   _boundsValid[i] = false;
+}
+
+double LayoutState::rotation(int i) const {
+   return _rotations.at(i);
+}
+
+QVector<double> const & LayoutState::rotations() const {
+   return _rotations;
+}
+
+double LayoutState::scale(int i) const {
+   return _scales.at(i);
+}
+
+Segment const * LayoutState::segment(int i) const {
+   return _segments.at(i);
+}
+
+SegmentList const & LayoutState::segments() const {
+   return _segments;
+}
+
+void LayoutState::setAngle(int i, double angle) {
+   _rotations[i] = angle - _segments.at(i)->originalAngle();
+   _boundsValid[i] = false;
+}
+
+void LayoutState::setPosition(int i, Position const & position) {
+   _positions[i] = position;
+   _boundsValid[i] = false;
+}
+
+void LayoutState::setRotation(int i, double rotation) {
+   _rotations[i] = rotation;
+   _boundsValid[i] = false;
+}
+
+int LayoutState::size() const {
+   return _segments.size();
+}
+
+LayoutState LayoutState::subset(QVector<int> const & indices) const {
+   LayoutState subset;
+   foreach (int const i, indices) {
+      subset._segments << _segments.at(i);
+      subset._indices << i;
+      subset._positions << _positions.at(i);
+      subset._rotations << _rotations.at(i);
+      subset._scales << _scales.at(i);
+      subset._bounds << _bounds.at(i);
+      subset._boundsValid << _boundsValid.at(i);
+   }
+   return subset;
+}
+
+Position LayoutState::topCenter() const {
+   Position pos(0.0, std::numeric_limits<double>::min());
+   int area = 0;
+
+   for (int i=0; i<size(); ++i) {
+      pos.x += _positions.at(i).x * _segments.at(i)->area();
+      area += _segments.at(i)->area();
+
+      pos.y = std::max(pos.y, _positions.at(i).y);
+   }
+   pos.x /= double(area);
+
+   return pos;
+}
+
+void LayoutState::translate(int i, Position const & vec) {
+   _positions[i] += vec;
+   _boundsValid[i] = false;
+}
+
+void LayoutState::translate(Position const & vec) {
+   for (int i=0; i<size(); ++i) {
+      _positions[i] += vec;
+   }
+   _boundsValid.fill(false);
+}
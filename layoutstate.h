@@ -0,0 +1,64 @@
+#ifndef LAYOUTSTATE_H
+#define LAYOUTSTATE_H
+
+#include <QRectF>
+#include <QVector>
+#include "pixel.h"
+#include "segmentlist.h"
+
+class Segment;
+
+struct Placement {
+   Position pos;
+   double angle;
+   double scale;
+};
+
+class LayoutState {
+
+public:
+   LayoutState();
+   explicit LayoutState(SegmentList const & segments);
+
+   LayoutState subset(QVector<int> const & indices) const;
+   void assign(LayoutState const & subset);
+
+   int size() const;
+   bool isEmpty() const;
+   SegmentList const & segments() const;
+   Segment const * segment(int i) const;
+   Placement placement(int i) const;
+
+   Position const & position(int i) const;
+   double angle(int i) const;
+   double rotation(int i) const;
+   double scale(int i) const;
+   QVector<Position> const & positions() const;
+   QVector<double> const & rotations() const;
+
+   void setPosition(int i, Position const & position);
+   void setAngle(int i, double angle);
+   void setRotation(int i, double rotation);
+   void translate(int i, Position const & vec);
+   void rotate(int i, double alpha);
+   void translate(Position const & vec);
+   void resetAngles();
+
+   int area() const;
+   Position center() const;
+   Position bottomCenter() const;
+   Position topCenter() const;
+   QRectF boundingRect(int i) const;
+   QRectF rect() const;
+
+private:
+   SegmentList _segments;
+   QVector<int> _indices;
+   QVector<Position> _positions;
+   QVector<double> _rotations;
+   QVector<double> _scales;
+   mutable QVector<QRectF> _bounds;
+   mutable QVector<bool> _boundsValid;
+};
+
+#endif // LAYOUTSTATE_H
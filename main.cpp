@@ -1,10 +1,19 @@
 #include <QApplication>
 #include "mainwindow.h"
+#include "trace.h"
 
 int main(int argc, char * argv[]) {
    QApplication a(argc, argv);
    MainWindow w;
    w.show();
 
-   return a.exec();
+   // TIDY_TRACE=<file> records a timeline of the session, written on exit
+   QString const trace = QString::fromLocal8Bit(qgetenv("TIDY_TRACE"));
+   Trace::setEnabled(!trace.isEmpty());
+   int const result = a.exec();
+   if (!trace.isEmpty() && !Trace::save(trace)) {
+      qWarning("Cannot write trace %s", qPrintable(trace));
+   }
+
+   return result;
 }
@@ -1,6 +1,8 @@
 #include "mainwindow.h"
+#include <cmath>
 #include <QAction>
 #include <QBoxLayout>
+#include <QCheckBox>
 #include <QComboBox>
 #include <QDockWidget>
 #include <QFileDialog>
@@ -9,16 +11,25 @@
 #include <QImageReader>
 #include <QLabel>
 #include <QMenuBar>
+#include <QProgressBar>
 #include <QPushButton>
 #include <QSplitter>
 #include <QStackedLayout>
+#include <QStatusBar>
+#include <QTimer>
+#include <QtConcurrent>
+#include "batchpipeline.h"
 #include "meanshiftdecomposer.h"
 #include "watersheddecomposer.h"
 #include "forcedirectedarranger.h"
 #include "clusteredarranger.h"
+#include "packingarranger.h"
+#include "runcontrol.h"
+#include "stats.h"
 
 MainWindow::MainWindow(QWidget * parent) :
-   QMainWindow(parent), arrangement(nullptr)
+   QMainWindow(parent), artifacts(ArtifactSink::Debug), arrangement(nullptr),
+   arrangeAfterDecompose(false), previewSide(256), previewPending(false)
 {
    setWindowTitle(tr("tidy"));
    resize(512, 384);
@@ -27,15 +38,60 @@ MainWindow::MainWindow(QWidget * parent) :
                << new WaterShedDecomposer();
 
    arrangers << new ForceDirectedArranger()
-             << new ClusteredArranger();
+             << new ClusteredArranger()
+             << new PackingArranger();
+
+   control = new RunControl(this);
+   itemControl = new RunControl(this);
+   connect(control, SIGNAL(stageChanged(QString, int)), this, SLOT(showStage(QString, int)));
+
+   // the interactive runs keep all intermediate images, written in the background
+   foreach (Decomposer * const decomposer, decomposers) {
+      decomposer->setArtifactSink(&artifacts);
+      decomposer->setRunControl(control);
+      decomposer->setChangeListener([this]() { schedulePreview(); });
+   }
+   foreach (Arranger * const arranger, arrangers) {
+      arranger->setArtifactSink(&artifacts);
+      arranger->setRunControl(control);
+   }
+
+   // the results are handed back to the gui thread when the workers are done
+   decomposeWatcher = new QFutureWatcher<SegmentList>(this);
+   connect(decomposeWatcher, SIGNAL(finished()), this, SLOT(decomposerFinished()));
+   arrangeWatcher = new QFutureWatcher<Arrangement>(this);
+   connect(arrangeWatcher, SIGNAL(finished()), this, SLOT(arrangerFinished()));
+   batchWatcher = new QFutureWatcher<int>(this);
+   connect(batchWatcher, SIGNAL(finished()), this, SLOT(batchDirectoryFinished()));
+   previewWatcher = new QFutureWatcher<SegmentList>(this);
+   connect(previewWatcher, SIGNAL(finished()), this, SLOT(previewFinished()));
+
+   // edits come in bursts (spin box arrows), only the last one is previewed
+   previewTimer = new QTimer(this);
+   previewTimer->setSingleShot(true);
+   previewTimer->setInterval(250);
+   connect(previewTimer, SIGNAL(timeout()), this, SLOT(runPreview()));
 
    createActions();
    createMenues();
    createCentralWidget();
    createDockWidgets();
+   createStatusBar();
 }
 
 MainWindow::~MainWindow() {
+   // a running worker still uses the segments and the decomposers
+   bool const decomposing = decomposeWatcher->isRunning();
+   stopPreview();
+   cancelRun();
+   decomposeWatcher->waitForFinished();
+   arrangeWatcher->waitForFinished();
+   batchWatcher->waitForFinished();
+   if (decomposing) {
+      SegmentList goners = decomposeWatcher->result();
+      goners.deleteAndClear();
+   }
+
    // delete segments
    segments.deleteAndClear();
    delete arrangement;
@@ -51,6 +107,37 @@ MainWindow::~MainWindow() {
    }
 }
 
+void MainWindow::arrangerFinished() {
+   finishRun();
+   if (control->isCanceled()) {
+      return;
+   }
+
+   // show the new arrangement and delete the old one
+   QGraphicsScene * goner = arrangement;
+   arrangement = Arranger::createScene(arrangeWatcher->result());
+   graphicsView->setScene(arrangement);
+   delete goner;
+}
+
+void MainWindow::batchDirectoryFinished() {
+   foreach (Decomposer * const decomposer, decomposers) {
+      decomposer->setRunControl(control);
+      decomposer->setStageCacheMegaBytes(StageCache::DefaultMegaBytes);
+   }
+   foreach (Arranger * const arranger, arrangers) {
+      arranger->setRunControl(control);
+   }
+   finishRun();
+   qDebug("Batchrun done, %d failures", batchWatcher->result());
+}
+
+void MainWindow::cancelRun() {
+   control->cancel();
+   itemControl->cancel();
+   cancelBtn->setEnabled(false);
+}
+
 void MainWindow::createActions() {
    openAction = new QAction(QIcon(":/icons/open16"), tr("&Open image"), this);
    openAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_O));
@@ -73,6 +160,9 @@ void MainWindow::createActions() {
 
    runBatchAction = new QAction(QIcon(":/icons/runall16"), tr("&Run batch"), this);
    connect(runBatchAction, SIGNAL(triggered()), this, SLOT(runBatch()));
+
+   runBatchDirectoryAction = new QAction(QIcon(":/icons/runall16"), tr("Run batch on &directory..."), this);
+   connect(runBatchDirectoryAction, SIGNAL(triggered()), this, SLOT(runBatchDirectory()));
 }
 
 QWidget * MainWindow::createArrangerWidget() {
@@ -88,7 +178,7 @@ QWidget * MainWindow::createArrangerWidget() {
    mainLayout->addWidget(arrangerSettings);
 
    QWidget * widgetSet;
-   foreach (Arranger const * const arranger, arrangers) {
+   foreach (Arranger * const arranger, arrangers) {
       arrangerBox->insertItem(arrangerBox->count(), arranger->getName());
       widgetSet = new QWidget();
       widgetSet->setLayout(arranger->getSettingsLayout());
@@ -134,7 +224,7 @@ QWidget * MainWindow::createDecomposerWidget() {
    mainLayout->addWidget(decomposerSettings);
 
    QWidget * widgetSet;
-   foreach (Decomposer const * const decomposer, decomposers) {
+   foreach (Decomposer * const decomposer, decomposers) {
       decomposerBox->insertItem(decomposerBox->count(), decomposer->getName());
       widgetSet = new QWidget();
       widgetSet->setLayout(decomposer->getSettingsLayout());
@@ -146,6 +236,12 @@ QWidget * MainWindow::createDecomposerWidget() {
    connect(runBtn, SIGNAL(clicked()), this, SLOT(runDecomposer()));
    mainLayout->addWidget(runBtn);
 
+   previewBox = new QCheckBox(tr("Live preview"));
+   previewBox->setToolTip(tr("Decompose a downscaled copy of the image whenever a setting changes"));
+   connect(previewBox, SIGNAL(toggled(bool)), this, SLOT(schedulePreview()));
+   connect(decomposerBox, SIGNAL(currentIndexChanged(int)), this, SLOT(schedulePreview()));
+   mainLayout->addWidget(previewBox);
+
    mainLayout->addStretch();
    widget->setLayout(mainLayout);
    return widget;
@@ -154,12 +250,14 @@ QWidget * MainWindow::createDecomposerWidget() {
 void MainWindow::createDockWidgets() {
    QDockWidget * decomposerDockWidget = new QDockWidget(tr("Decomposer"), this);
    decomposerDockWidget->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
-   decomposerDockWidget->setWidget(createDecomposerWidget());
+   decomposerSettings = createDecomposerWidget();
+   decomposerDockWidget->setWidget(decomposerSettings);
    addDockWidget(Qt::LeftDockWidgetArea, decomposerDockWidget);
 
    QDockWidget * arrangerDockWidget = new QDockWidget(tr("Arranger"), this);
    arrangerDockWidget->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
-   arrangerDockWidget->setWidget(createArrangerWidget());
+   arrangerSettings = createArrangerWidget();
+   arrangerDockWidget->setWidget(arrangerSettings);
    addDockWidget(Qt::LeftDockWidgetArea, arrangerDockWidget);
 }
 
@@ -175,9 +273,87 @@ void MainWindow::createMenues() {
    runMenu->addSeparator();
    runMenu->addAction(runAllAction);
    runMenu->addAction(runBatchAction);
+   runMenu->addAction(runBatchDirectoryAction);
+}
+
+void MainWindow::createStatusBar() {
+   stageLbl = new QLabel();
+   progressBar = new QProgressBar();
+   progressBar->setMaximumWidth(200);
+   cancelBtn = new QPushButton(tr("Cancel"));
+   connect(cancelBtn, SIGNAL(clicked()), this, SLOT(cancelRun()));
+   connect(control, SIGNAL(progressChanged(int)), progressBar, SLOT(setValue(int)));
+   statusBar()->addPermanentWidget(stageLbl);
+   statusBar()->addPermanentWidget(progressBar);
+   statusBar()->addPermanentWidget(cancelBtn);
+   stageLbl->hide();
+   progressBar->hide();
+   cancelBtn->hide();
+}
+
+SegmentList MainWindow::decomposeImage(Decomposer const * decomposer, bool batch) {
+   // runs in a worker thread, a canceled decomposition is neither cached nor shown
+   SegmentList result;
+   QByteArray const key = SegmentCache::key(image, *decomposer);
+   if (!cache.load(key, image, result)) {
+      result = batch ? decomposer->decomposeBatch(image, name) : decomposer->decompose(image);
+      if (control->isCanceled()) {
+         result.deleteAndClear();
+         return result;
+      }
+      cache.store(key, image, result);
+   }
+   TIDY_STAGE(tr("Preparing"));
+   result.prepare();
+   return result;
+}
+
+void MainWindow::decomposerFinished() {
+   // layouts kept by the arrangers refer to the old segments
+   foreach (Arranger * const arranger, arrangers) {
+      arranger->forgetSegments();
+   }
+   segments = decomposeWatcher->result();
+   finishRun();
+   if (control->isCanceled()) {
+      segments.deleteAndClear();
+      arrangeAfterDecompose = false;
+      return;
+   }
+
+   // show segmented image
+   ImageColor resultImage(image.width(), image.height());
+   segments.copyToImageAVG(resultImage);
+   imgSegmLbl->setPixmap(QPixmap::fromImage(resultImage.toQImage()));
+
+   if (arrangeAfterDecompose) {
+      arrangeAfterDecompose = false;
+      runArranger();
+   }
+}
+
+void MainWindow::finishRun() {
+   stageLbl->hide();
+   progressBar->hide();
+   cancelBtn->hide();
+   openAction->setEnabled(true);
+   runDecomposerAction->setEnabled(true);
+   runArrangerAction->setEnabled(true);
+   runAllAction->setEnabled(true);
+   runBatchAction->setEnabled(true);
+   runBatchDirectoryAction->setEnabled(true);
+   decomposerSettings->setEnabled(true);
+   arrangerSettings->setEnabled(true);
+}
+
+bool MainWindow::isRunning() const {
+   return decomposeWatcher->isRunning() || arrangeWatcher->isRunning() || batchWatcher->isRunning();
 }
 
 void MainWindow::openImage() {
+   if (isRunning()) {
+      return;
+   }
    static QString filter = supportedImageReaderFormatsFilter();
 
    QString filename = QFileDialog::getOpenFileName(this,
@@ -186,50 +362,208 @@ void MainWindow::openImage() {
                                                    filter);
    if (!filename.isNull()) {
       //load image
+      stopPreview();
       image = ImageColor(filename);
+      previewImage = ImageColor();
       imgOrigLbl->setPixmap(QPixmap::fromImage(image.toQImage()));
 
       int begin = filename.lastIndexOf('/')+1;
       int width = filename.lastIndexOf('.') - begin;
       name = filename.mid(begin, width);
+      schedulePreview();
+   }
+}
+
+void MainWindow::previewFinished() {
+   if (!previewPending) {
+      return;
+   }
+   previewPending = false;
+   SegmentList result = previewWatcher->result();
+   if (control->isCanceled() || isRunning()) {
+      result.deleteAndClear();
+      return;
+   }
+
+   // show the labels stretched to the size of the original
+   ImageColor labels(previewImage.width(), previewImage.height());
+   result.copyToImageAVG(labels);
+   result.deleteAndClear();
+   imgSegmLbl->setPixmap(QPixmap::fromImage(labels.toQImage().scaled(image.width(), image.height())));
+
+   // keep the preview within its latency budget, it grows only slowly because
+   // cached stages make a run look cheaper than the next one at a new size is
+   int const budget = 400;
+   qint64 const elapsed = std::max<qint64>(1, previewTime.elapsed());
+   if (elapsed > budget || elapsed < budget/2) {
+      double const factor = qBound(0.5, std::sqrt(double(budget)/elapsed), 1.25);
+      previewSide = qBound(64, qRound(previewSide*factor), std::max(64, image.maxWH()));
    }
 }
 
 void MainWindow::runAll() {
+   if (isRunning()) {
+      return;
+   }
+   arrangeAfterDecompose = true;
    runDecomposer();
-   runArranger();
 }
 
 void MainWindow::runArranger() {
-   QGraphicsScene * goner = arrangement;
-   arrangement = arrangers.at(arrangerBox->currentIndex())->arrange(segments);
-
-   // show the new arrangement
-   graphicsView->setScene(arrangement);
-
-   // delete the old arrangement
-   delete goner;
+   if (isRunning()) {
+      return;
+   }
+   startRun();
+   Arranger const * const arranger = arrangers.at(arrangerBox->currentIndex());
+   arrangeWatcher->setFuture(QtConcurrent::run([this, arranger]() {
+      return arranger->arrange(segments);
+   }));
 }
 
 void MainWindow::runBatch() {
+   if (isRunning()) {
+      return;
+   }
    segments.deleteAndClear();
-   segments = decomposers.at(decomposerBox->currentIndex())->decomposeBatch(image, name);
-   segments.prepare();
+   startRun();
+   Decomposer const * const decomposer = decomposers.at(decomposerBox->currentIndex());
+   decomposeWatcher->setFuture(QtConcurrent::run([this, decomposer]() {
+#ifdef TIDY_STATS
+      Stats stats;
+      StatsScope const scope(&stats);
+#endif
+      SegmentList result = decomposeImage(decomposer, true);
+      foreach (Arranger const * const arranger, arrangers) {
+         if (!control->isCanceled()) {
+            arranger->arrangeBatch(result, name);
+         }
+      }
+#ifdef TIDY_STATS
+      stats.leaveStage();
+      if (!control->isCanceled() && !stats.save(name + "/stats.json")) {
+         qWarning("Cannot write stats of %s", qPrintable(name));
+      }
+#endif
+      qDebug("Batchrun done");
+      return result;
+   }));
+}
+
+void MainWindow::runBatchDirectory() {
+   if (isRunning()) {
+      return;
+   }
+   QString const directory = QFileDialog::getExistingDirectory(this, tr("Open image directory"));
+   if (directory.isNull()) {
+      return;
+   }
+
+   // the progress shows the images, the stages of each image would only flicker
+   // and the stage caches would only copy the segments of images never seen again
+   foreach (Decomposer * const decomposer, decomposers) {
+      decomposer->setRunControl(itemControl);
+      decomposer->setStageCacheMegaBytes(0);
+   }
    foreach (Arranger * const arranger, arrangers) {
-      arranger->arrangeBatch(segments, name);
+      arranger->setRunControl(itemControl);
    }
-   qDebug("Batchrun done");
+
+   // the results are written below the working directory, like a single batch
+   startRun();
+   Decomposer const * const decomposer = decomposers.at(decomposerBox->currentIndex());
+   batchWatcher->setFuture(QtConcurrent::run([this, decomposer, directory]() {
+      BatchPipeline pipeline(*decomposer, arrangers, ".");
+      pipeline.setArtifactSink(&artifacts);
+      pipeline.setCache(cache);
+      pipeline.setRunControl(control);
+      return pipeline.run(BatchPipeline::imagesInDirectory(directory));
+   }));
 }
 
 void MainWindow::runDecomposer() {
+   if (isRunning()) {
+      return;
+   }
    segments.deleteAndClear();
-   segments = decomposers.at(decomposerBox->currentIndex())->decompose(image);
-   segments.prepare();
+   startRun();
+   Decomposer const * const decomposer = decomposers.at(decomposerBox->currentIndex());
+   decomposeWatcher->setFuture(QtConcurrent::run([this, decomposer]() {
+      return decomposeImage(decomposer, false);
+   }));
+}
 
-   // show segmented image
-   ImageColor resultImage(image.width(), image.height());
-   segments.copyToImageAVG(resultImage);
-   imgSegmLbl->setPixmap(QPixmap::fromImage(resultImage.toQImage()));
+void MainWindow::runPreview() {
+   if (!previewBox->isChecked() || image.isNull() || isRunning()) {
+      return;
+   }
+   stopPreview();
+   control->reset();
+
+   // the downscaled copy is only rebuilt when the preview size changes
+   double const scale = std::min(1.0, double(previewSide)/image.maxWH());
+   int const width = std::max(1, qRound(image.width()*scale));
+   int const height = std::max(1, qRound(image.height()*scale));
+   if (previewImage.width() != width || previewImage.height() != height) {
+      previewImage = ImageColor(image.toQImage().scaled(width, height, Qt::IgnoreAspectRatio,
+                                                        Qt::SmoothTransformation));
+   }
+
+   // the settings stay editable during a preview, so the worker only gets a snapshot
+   Decomposer const * const decomposer = decomposers.at(decomposerBox->currentIndex());
+   std::function<SegmentList()> const task = decomposer->previewTask(previewImage, double(width)/image.width());
+   previewPending = true;
+   previewTime.start();
+   previewWatcher->setFuture(QtConcurrent::run(task));
+}
+
+void MainWindow::schedulePreview() {
+   // a stale preview is canceled right away, the next one starts when the edits pause
+   if (!previewBox->isChecked() || isRunning()) {
+      return;
+   }
+   if (previewPending) {
+      control->cancel();
+   }
+   previewTimer->start();
+}
+
+void MainWindow::showStage(QString const & stage, int maximum) {
+   stageLbl->setText(stage);
+   progressBar->setRange(0, maximum);
+   progressBar->setValue(0);
+}
+
+void MainWindow::startRun() {
+   // the image, the segments and the settings stay untouched until the run is finished
+   stopPreview();
+   previewTimer->stop();
+   control->reset();
+   itemControl->reset();
+   stageLbl->clear();
+   progressBar->setRange(0, 0);
+   stageLbl->show();
+   progressBar->show();
+   cancelBtn->show();
+   cancelBtn->setEnabled(true);
+   openAction->setEnabled(false);
+   runDecomposerAction->setEnabled(false);
+   runArrangerAction->setEnabled(false);
+   runAllAction->setEnabled(false);
+   runBatchAction->setEnabled(false);
+   runBatchDirectoryAction->setEnabled(false);
+   decomposerSettings->setEnabled(false);
+   arrangerSettings->setEnabled(false);
+}
+
+void MainWindow::stopPreview() {
+   // waits for a running preview, its segments are not needed anymore
+   if (previewPending) {
+      previewPending = false;
+      control->cancel();
+      previewWatcher->waitForFinished();
+      SegmentList goners = previewWatcher->result();
+      goners.deleteAndClear();
+   }
 }
 
 QString MainWindow::supportedImageReaderFormatsFilter() const {
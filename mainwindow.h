@@ -1,16 +1,25 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 #include <QMainWindow>
+#include "arranger.h"
+#include "artifactsink.h"
 #include "image.h"
+#include "segmentcache.h"
 #include "segmentlist.h"
 
+class QCheckBox;
 class QLabel;
+class QTimer;
 class QComboBox;
 class QGraphicsView;
 class QGraphicsScene;
+class QProgressBar;
+class QPushButton;
 class Decomposer;
-class Arranger;
+class RunControl;
 
 class MainWindow : public QMainWindow {
 
@@ -27,33 +36,75 @@ private:
    QAction * runArrangerAction;
    QAction * runAllAction;
    QAction * runBatchAction;
+   QAction * runBatchDirectoryAction;
    QLabel * imgOrigLbl;
    QLabel * imgSegmLbl;
    QGraphicsView * graphicsView;
    QComboBox * decomposerBox;
    QComboBox * arrangerBox;
+   QLabel * stageLbl;
+   QProgressBar * progressBar;
+   QPushButton * cancelBtn;
+   QCheckBox * previewBox;
+   // the workers read the parameters, so the settings are locked while they run
+   QWidget * decomposerSettings;
+   QWidget * arrangerSettings;
 
    QString name;
    ImageColor image;
    SegmentList segments;
+   SegmentCache cache;
+   ArtifactSink artifacts;
    QGraphicsScene * arrangement;
    QList<Decomposer *> decomposers;
    QList<Arranger *> arrangers;
 
+   // the runs are done in worker threads, one at a time
+   RunControl * control;
+   // cancels the single images of a directory batch without reporting their stages
+   RunControl * itemControl;
+   QFutureWatcher<SegmentList> * decomposeWatcher;
+   QFutureWatcher<Arrangement> * arrangeWatcher;
+   QFutureWatcher<int> * batchWatcher;
+   bool arrangeAfterDecompose;
+
+   // the live preview decomposes a downscaled copy while the settings are edited
+   QFutureWatcher<SegmentList> * previewWatcher;
+   QTimer * previewTimer;
+   QElapsedTimer previewTime;
+   ImageColor previewImage;
+   int previewSide;
+   bool previewPending;
+
    void createActions();
    void createMenues();
    void createCentralWidget();
    void createDockWidgets();
    QWidget * createDecomposerWidget();
    QWidget * createArrangerWidget();
+   void createStatusBar();
+   SegmentList decomposeImage(Decomposer const * decomposer, bool batch);
+   void finishRun();
+   bool isRunning() const;
+   void stopPreview();
+   void startRun();
    QString supportedImageReaderFormatsFilter() const;
 
 private slots:
+   void arrangerFinished();
+   void batchDirectoryFinished();
+   void cancelRun();
+   void decomposerFinished();
    void openImage();
+   void previewFinished();
    void runDecomposer();
    void runArranger();
+   void runPreview();
+   void schedulePreview();
    void runAll();
    void runBatch();
+   void runBatchDirectory();
+   void showStage(QString const & stage, int maximum);
 };
 
 #endif // MAINWINDOW_H
@@ -3,58 +3,59 @@
 #include <QtConcurrent>
 #include <QDoubleSpinBox>
 #include <QFormLayout>
-#include <QProgressDialog>
 #include <QSpinBox>
 #include <QTime>
 #include "pixel.h"
 #include "image.h"
+#include "runcontrol.h"
 #include "segment.h"
 #include "segmentlist.h"
+#include "stats.h"
+#include "trace.h"
 
 MeanShiftDecomposer::MeanShiftDecomposer() :
    Decomposer("Mean Shift Decomposer")
 {
-   populateSettingsLayout();
 }
 
 SegmentList MeanShiftDecomposer::decompose(ImageColor const & image) const {
-   QTime time;
-   time.start();
+   TraceSpan const span("MeanShiftDecomposer::decompose");
+   MeanShiftParameters const params = parameters;
 
    // original image
-   image.save("MS1_original.png");
+   saveDebug(image, "MS1_original.png");
 
    // filter image
-   time.restart();
-   ImageColor imageFiltered = filter(image);
-   qDebug("Data filtered in %g seconds", time.restart()/1000.0);
-   imageFiltered.save("MS2_filtered.png");
+   QByteArray const imageKey = StageCache::imageKey(image);
+   ImageColor imageFiltered = filter(image, imageKey, params);
+   if (canceled()) {
+      return SegmentList();
+   }
+   saveDebug(imageFiltered, "MS2_filtered.png");
 
    // label regions
-   time.restart();
-   SegmentList segments = labelRegions(imageFiltered, image);
-   qDebug("Regions labeled in %g seconds", time.restart()/1000.0);
+   SegmentList segments = labelRegions(imageFiltered, image, imageKey, params);
    qDebug("  Segments: %d", segments.size());
-   segments.copyToImageAVG(imageFiltered);
-   imageFiltered.save("MS3_labeled.png");
+   if (debugArtifacts()) {
+      segments.copyToImageAVG(imageFiltered);
+   }
+   saveDebug(imageFiltered, "MS3_labeled.png");
 
    // merge similiar and small segments
-   time.restart();
-   int oldSegmentsSize;
-   do {
-      oldSegmentsSize = segments.size();
-      mergeSimiliarSegments(segments, epsilonMerge->value()*epsilonMerge->value());
-      mergeSmallSegments(segments, minSize->value());
-   } while (segments.size() != oldSegmentsSize);
-   qDebug("Segments merged in %g seconds", time.restart()/1000.0);
+   mergeSegments(segments, params.epsilonMerge, params.minSize);
    qDebug("  Segments: %d", segments.size());
-   segments.copyToImageAVG(imageFiltered);
-   imageFiltered.save("MS4_merged.png");
+   if (debugArtifacts()) {
+      segments.copyToImageAVG(imageFiltered);
+   }
+   saveDebug(imageFiltered, "MS4_merged.png");
 
    return segments;
 }
 
 SegmentList MeanShiftDecomposer::decomposeBatch(ImageColor const & image, QString const & name) const {
+   TraceSpan const span("MeanShiftDecomposer::decomposeBatch");
+   MeanShiftParameters const params = parameters;
+
    QDir dir;
    dir.mkpath(name);
 
@@ -62,96 +63,145 @@ SegmentList MeanShiftDecomposer::decomposeBatch(ImageColor const & image, QStrin
    file.open(QFile::WriteOnly | QFile::Truncate);
    QTextStream out(&file);
    out << "Mean Shift Decomposer" << endl;
-   out << "   Sigma pos: " << sigmaPos->value() << endl;
-   out << "   Sigma col: " << sigmaCol->value() << endl;
-   out << "   Minimum Size: " << minSize->value() << endl;
-   out << "   eps shift: " << epsilonShift->value() << endl;
-   out << "   eps merge: " << epsilonMerge->value() << endl;
+   out << "   Sigma pos: " << params.sigmaPos << endl;
+   out << "   Sigma col: " << params.sigmaCol << endl;
+   out << "   Minimum Size: " << params.minSize << endl;
+   out << "   eps shift: " << params.epsilonShift << endl;
+   out << "   eps merge: " << params.epsilonMerge << endl;
    out << endl;
 
    QTime time;
    time.start();
 
    // original image
-   image.save(name + "/MS1_original.png");
+   saveDebug(image, name + "/MS1_original.png");
 
    // filter image
    time.restart();
-   ImageColor imageFiltered = filter(image);
+   QByteArray const imageKey = StageCache::imageKey(image);
+   ImageColor imageFiltered = filter(image, imageKey, params);
    out << "Data filtered in " << time.restart()/1000.0 << " seconds" << endl;
-   imageFiltered.save(name + "/MS2_filtered.png");
+   if (canceled()) {
+      return SegmentList();
+   }
+   saveDebug(imageFiltered, name + "/MS2_filtered.png");
 
    // label regions
    time.restart();
-   SegmentList segments = labelRegions(imageFiltered, image);
+   SegmentList segments = labelRegions(imageFiltered, image, imageKey, params);
    out << "Regions labeled in " << time.restart()/1000.0 << " seconds" << endl;
    out << "   Segments: " << segments.size() << endl;
-   segments.copyToImageAVG(imageFiltered);
-   imageFiltered.save(name + "/MS3_labeled.png");
+   if (debugArtifacts()) {
+      segments.copyToImageAVG(imageFiltered);
+   }
+   saveDebug(imageFiltered, name + "/MS3_labeled.png");
 
    // merge similiar and small segments
    time.restart();
-   int oldSegmentsSize;
-   do {
-      oldSegmentsSize = segments.size();
-      mergeSimiliarSegments(segments, epsilonMerge->value()*epsilonMerge->value());
-      mergeSmallSegments(segments, minSize->value());
-   } while (segments.size() != oldSegmentsSize);
+   mergeSegments(segments, params.epsilonMerge, params.minSize);
    out << "Segments merged in " << time.restart()/1000.0 << " seconds" << endl;
    out << "   Segments: " << segments.size() << endl;
-   segments.copyToImageAVG(imageFiltered);
-   imageFiltered.save(name + "/MS4_merged.png");
+   if (debugArtifacts()) {
+      segments.copyToImageAVG(imageFiltered);
+   }
+   saveDebug(imageFiltered, name + "/MS4_merged.png");
 
    return segments;
 }
 
-ImageColor MeanShiftDecomposer::filter(ImageColor const & image) const {
+SegmentList MeanShiftDecomposer::decomposePreview(ImageColor const & image,
+                                                  MeanShiftParameters const & params) const {
+   TraceSpan const span("MeanShiftDecomposer::decomposePreview");
+   // no debug images are written
+   QByteArray const imageKey = StageCache::imageKey(image);
+   ImageColor const imageFiltered = filter(image, imageKey, params);
+   if (canceled()) {
+      return SegmentList();
+   }
+   SegmentList segments = labelRegions(imageFiltered, image, imageKey, params);
+   mergeSegments(segments, params.epsilonMerge, params.minSize);
+   return segments;
+}
+
+ImageColor MeanShiftDecomposer::filter(ImageColor const & image, QByteArray const & imageKey,
+                                       MeanShiftParameters const & params) const {
+   TraceSpan const span("MeanShiftDecomposer::filter");
+   // the filter only depends on the kernel
+   QByteArray const key = imageKey + QString(";filter;%1;%2;%3").arg(params.sigmaPos)
+                                     .arg(params.sigmaCol).arg(params.epsilonShift).toUtf8();
+   ImageColor imageFiltered;
+   if (stageCache.find(key, imageFiltered)) {
+      return imageFiltered;
+   }
+
    // create lattice
    Lattice lattice;
    for (int y=0; y<image.height(); ++y) {
       for (int x=0; x<image.width(); ++x) {
-         lattice.insert(QPair<int, int>(qRound(x / sigmaPos->value()),
-                                        qRound(y / sigmaPos->value())),
-                        Pixel(Position(x, y) / sigmaPos->value(),
-                              image.at(x, y) / sigmaCol->value()));
+         lattice.insert(QPair<int, int>(qRound(x / params.sigmaPos),
+                                        qRound(y / params.sigmaPos)),
+                        Pixel(Position(x, y) / params.sigmaPos,
+                              image.at(x, y) / params.sigmaCol));
       }
    }
 
    // create data for mapped filter
    QList<FilterData> filterData;
+#ifdef TIDY_STATS
+   Stats * const stats = Stats::current();
+#endif
    foreach (Pixel const & pixel, lattice) {
       filterData << FilterData{pixel, lattice,
-                               sigmaPos->value(), sigmaCol->value(),
-                               epsilonShift->value()*epsilonShift->value()};
+                               params.sigmaPos, params.sigmaCol,
+                               params.epsilonShift*params.epsilonShift, control
+#ifdef TIDY_STATS
+                               , stats
+#endif
+                              };
    }
 
+#ifdef TIDY_STATS
+   // a lattice node holds the key and the pixel, the list items are nodes of their own
+   qint64 const workBytes = qint64(lattice.size())*(sizeof(QPair<int, int>) + sizeof(Pixel) + 32) +
+                            qint64(filterData.size())*(sizeof(FilterData) + sizeof(void *) + 16) +
+                            qint64(filterData.size())*(sizeof(Pixel) + sizeof(void *) + 16);
+   TIDY_ALLOCATE(WorkMemory, workBytes);
+#endif
+
    // filter
-   QProgressDialog progress("Applying mean shift filter...", "Abort", 0, image.area());
-   progress.setMinimumDuration(0);
-   progress.setModal(true);
-   QFuture<Pixel> future = QtConcurrent::mapped(filterData, filterMT);
-   while (future.isRunning()) {
-      progress.setValue(future.progressValue());
-      if(progress.wasCanceled()) {
-         future.cancel();
-      }
-      qApp->processEvents();
-   }
-   QList<Pixel> dataFiltered = future.results();
-   //QList<Pixel> dataFiltered = QtConcurrent::blockingMapped(filterData, filterMT);
+   beginStage(QObject::tr("Filtering"), filterData.size());
+   QList<Pixel> dataFiltered = QtConcurrent::blockingMapped(filterData, filterMT);
 
    // store filtered data in a Luv image
-   ImageColor imageFiltered(image.width(), image.height());
+   imageFiltered = ImageColor(image.width(), image.height());
    foreach (Pixel const & pixel, dataFiltered) {
       imageFiltered.at(qRound(pixel.pos.x), qRound(pixel.pos.y)) = pixel.col;
    }
 
+   // a canceled filter leaves pixels unfiltered, nothing to remember
+   if (!canceled()) {
+      stageCache.insert(key, imageFiltered);
+   }
+#ifdef TIDY_STATS
+   TIDY_RELEASE(WorkMemory, workBytes);
+#endif
    return imageFiltered;
 }
 
 SegmentList MeanShiftDecomposer::labelRegions(ImageColor const & filtered,
-                                              ImageColor const & image) const {
+                                              ImageColor const & image, QByteArray const & imageKey,
+                                              MeanShiftParameters const & params) const {
+   TraceSpan const span("MeanShiftDecomposer::labelRegions");
+   // the regions depend on the filter and the merge distance, not on the minimum size
+   QByteArray const key = imageKey + QString(";labels;%1;%2;%3;%4").arg(params.sigmaPos)
+                                     .arg(params.sigmaCol).arg(params.epsilonShift)
+                                     .arg(params.epsilonMerge).toUtf8();
    SegmentList segments;
+   if (stageCache.find(key, segments)) {
+      return segments;
+   }
+
+   beginStage(QObject::tr("Labeling regions"), filtered.height());
    std::unique_ptr<int[]> labels(new int[filtered.area()]);
    for (int i=0; i<filtered.area(); ++i) labels[i] = -1;
 
@@ -159,7 +209,7 @@ SegmentList MeanShiftDecomposer::labelRegions(ImageColor const & filtered,
                  -filtered.width()-1, -filtered.width()+1,
                  filtered.width()-1, filtered.width()+1};
 
-   double const epsilonMergeSquared = epsilonMerge->value() * epsilonMerge->value();
+   double const epsilonMergeSquared = params.epsilonMerge * params.epsilonMerge;
    int lastLabel = -1;
    QQueue<int> queue;
    Color color;
@@ -167,6 +217,9 @@ SegmentList MeanShiftDecomposer::labelRegions(ImageColor const & filtered,
    QList<Pixel *> pixels;
    int j, k;
    for (int i=0; i<filtered.area(); ++i) {
+      if (i%filtered.width() == 0) {
+         advance();
+      }
       if (labels[i] < 0) {
          // create new label and start region growing
          labels[i] = ++lastLabel;
@@ -210,55 +263,118 @@ SegmentList MeanShiftDecomposer::labelRegions(ImageColor const & filtered,
       }
    }
 
+   stageCache.insert(key, segments);
    return segments;
 }
 
+QString MeanShiftDecomposer::parameterKey() const {
+   return QString("sigmaPos=%1;sigmaCol=%2;minSize=%3;epsilonShift=%4;epsilonMerge=%5")
+         .arg(parameters.sigmaPos).arg(parameters.sigmaCol).arg(parameters.minSize)
+         .arg(parameters.epsilonShift).arg(parameters.epsilonMerge);
+}
+
+std::function<SegmentList()> MeanShiftDecomposer::previewTask(ImageColor const & image, double scale) const {
+   // the spatial parameters shrink with the image
+   MeanShiftParameters params = parameters;
+   params.sigmaPos = std::max(1.0, params.sigmaPos*scale);
+   params.minSize = std::max(1, qRound(params.minSize*scale*scale));
+   return [this, &image, params]() {
+      return decomposePreview(image, params);
+   };
+}
+
 void MeanShiftDecomposer::populateSettingsLayout() {
-   sigmaPos = new QDoubleSpinBox();
-   sigmaPos->setRange(1.0, 100.0);
-   sigmaPos->setValue(16.0);
-   sigmaPos->setToolTip(QObject::tr("The radius of the Mean Shift kernel in the spatial dimension"));
-   settingsLayout->addRow(QChar(963)+QObject::tr(" position"), sigmaPos);
-
-   sigmaCol = new QDoubleSpinBox();
-   sigmaCol->setRange(1.0, 100.0);
-   sigmaCol->setValue(8.0);
-   sigmaCol->setToolTip(QObject::tr("The radius of the Mean Shift kernel in the color dimension"));
-   settingsLayout->addRow(QChar(963)+QObject::tr(" color"), sigmaCol);
-
-   minSize = new QSpinBox();
-   minSize->setRange(1, 10000);
-   minSize->setValue(50);
-   minSize->setToolTip(QObject::tr("The minimal allowed segment size (smaller segments will be merged)"));
-   settingsLayout->addRow(QObject::tr("Minimum size"), minSize);
-
-   epsilonShift = new QDoubleSpinBox();
-   epsilonShift->setDecimals(3);
-   epsilonShift->setRange(0.001, 1.0);
-   epsilonShift->setValue(0.03);
-   epsilonShift->setSingleStep(0.01);
-   epsilonShift->setToolTip(QObject::tr("The minimum threshold for the Mean Shift step width"));
-   settingsLayout->addRow(QChar(949)+QObject::tr(" shift"), epsilonShift);
-
-   epsilonMerge = new QDoubleSpinBox();
-   epsilonMerge->setRange(0.5, 50.0);
-   epsilonMerge->setValue(1.0);
-   epsilonMerge->setSingleStep(0.1);
-   epsilonMerge->setToolTip(QObject::tr("The minimum color space distance (nearer segments will be merged)"));
-   settingsLayout->addRow(QChar(949)+QObject::tr(" merge"), epsilonMerge);
+   QDoubleSpinBox * sigmaPosBox = new QDoubleSpinBox();
+   sigmaPosBox->setRange(1.0, 100.0);
+   sigmaPosBox->setValue(parameters.sigmaPos);
+   sigmaPosBox->setToolTip(QObject::tr("The radius of the Mean Shift kernel in the spatial dimension"));
+   QObject::connect(sigmaPosBox, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+                    [this](double value) { parameters.sigmaPos = value; parametersChanged(); });
+   settingsLayout->addRow(QChar(963)+QObject::tr(" position"), sigmaPosBox);
+
+   QDoubleSpinBox * sigmaColBox = new QDoubleSpinBox();
+   sigmaColBox->setRange(1.0, 100.0);
+   sigmaColBox->setValue(parameters.sigmaCol);
+   sigmaColBox->setToolTip(QObject::tr("The radius of the Mean Shift kernel in the color dimension"));
+   QObject::connect(sigmaColBox, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+                    [this](double value) { parameters.sigmaCol = value; parametersChanged(); });
+   settingsLayout->addRow(QChar(963)+QObject::tr(" color"), sigmaColBox);
+
+   QSpinBox * minSizeBox = new QSpinBox();
+   minSizeBox->setRange(1, 10000);
+   minSizeBox->setValue(parameters.minSize);
+   minSizeBox->setToolTip(QObject::tr("The minimal allowed segment size (smaller segments will be merged)"));
+   QObject::connect(minSizeBox, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+                    [this](int value) { parameters.minSize = value; parametersChanged(); });
+   settingsLayout->addRow(QObject::tr("Minimum size"), minSizeBox);
+
+   QDoubleSpinBox * epsilonShiftBox = new QDoubleSpinBox();
+   epsilonShiftBox->setDecimals(3);
+   epsilonShiftBox->setRange(0.001, 1.0);
+   epsilonShiftBox->setValue(parameters.epsilonShift);
+   epsilonShiftBox->setSingleStep(0.01);
+   epsilonShiftBox->setToolTip(QObject::tr("The minimum threshold for the Mean Shift step width"));
+   QObject::connect(epsilonShiftBox, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+                    [this](double value) { parameters.epsilonShift = value; parametersChanged(); });
+   settingsLayout->addRow(QChar(949)+QObject::tr(" shift"), epsilonShiftBox);
+
+   QDoubleSpinBox * epsilonMergeBox = new QDoubleSpinBox();
+   epsilonMergeBox->setRange(0.5, 50.0);
+   epsilonMergeBox->setValue(parameters.epsilonMerge);
+   epsilonMergeBox->setSingleStep(0.1);
+   epsilonMergeBox->setToolTip(QObject::tr("The minimum color space distance (nearer segments will be merged)"));
+   QObject::connect(epsilonMergeBox, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+                    [this](double value) { parameters.epsilonMerge = value; parametersChanged(); });
+   settingsLayout->addRow(QChar(949)+QObject::tr(" merge"), epsilonMergeBox);
+}
+
+bool MeanShiftDecomposer::setParameter(QString const & key, QString const & value) {
+   // same ranges as the settings widgets
+   bool ok;
+   double const number = value.toDouble(&ok);
+   if (!ok) {
+      return false;
+   }
+   if (key == "sigmaPos") {
+      parameters.sigmaPos = qBound(1.0, number, 100.0);
+   }
+   else if (key == "sigmaCol") {
+      parameters.sigmaCol = qBound(1.0, number, 100.0);
+   }
+   else if (key == "minSize") {
+      parameters.minSize = qBound(1, qRound(number), 10000);
+   }
+   else if (key == "epsilonShift") {
+      parameters.epsilonShift = qBound(0.001, number, 1.0);
+   }
+   else if (key == "epsilonMerge") {
+      parameters.epsilonMerge = qBound(0.5, number, 50.0);
+   }
+   else {
+      return false;
+   }
+   return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 Pixel filterMT(FilterData const & data) {
+   // skipped once the run is canceled
+   if (data.control && data.control->isCanceled()) {
+      return Pixel(data.pixel.pos * data.sigmaPos, data.pixel.col * data.sigmaCol);
+   }
+
    Pixel center;
    Pixel nextCenter = data.pixel;
    double const weight = 1.0;
    double sumOfWeights;
    QPair<int, int> key;
    Lattice::const_iterator it;
+   int iterations = 0;
+   qint64 compared = 0;
 
    do {
+      ++iterations;
       center = nextCenter;
       nextCenter = Pixel();
       sumOfWeights = 0.0;
@@ -268,6 +384,7 @@ Pixel filterMT(FilterData const & data) {
                                   qRound(center.pos.y)+dy);
             it = data.lattice.find(key);
             while (it!=data.lattice.end() && it.key()==key) {
+               ++compared;
                if ((it.value()-center).magnitudeSquared() <= 1.0) {
                   nextCenter += it.value() * weight;
                   sumOfWeights += weight;
@@ -278,5 +395,15 @@ Pixel filterMT(FilterData const & data) {
       }
       nextCenter /= sumOfWeights;
    } while ((nextCenter - center).magnitudeSquared() > data.epsSquared);
+#ifdef TIDY_STATS
+   StatsScope const scope(data.stats);
+#endif
+   TIDY_COUNT(MeanShiftPixels, 1);
+   TIDY_COUNT(LatticeCellsVisited, 9*iterations);
+   TIDY_COUNT(LatticePixelsCompared, compared);
+   TIDY_SAMPLE(MeanShiftIterations, iterations);
+   if (data.control) {
+      data.control->advance();
+   }
    return Pixel(data.pixel.pos * data.sigmaPos, nextCenter.col * data.sigmaCol);
 }
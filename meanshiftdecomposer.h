@@ -4,29 +4,39 @@
 #include <QMultiHash>
 #include "decomposer.h"
 
-class QSpinBox;
-class QDoubleSpinBox;
 struct Pixel;
+class RunControl;
+class Stats;
 using Lattice = QMultiHash<QPair<int, int>, Pixel>;
 
+struct MeanShiftParameters {
+   double sigmaPos = 16.0;
+   double sigmaCol = 8.0;
+   int minSize = 50;
+   double epsilonShift = 0.03;
+   double epsilonMerge = 1.0;
+};
+
 class MeanShiftDecomposer : public Decomposer {
 
 public:
    MeanShiftDecomposer();
    virtual SegmentList decompose(ImageColor const & image) const;
    virtual SegmentList decomposeBatch(ImageColor const & image, QString const & name) const;
+   virtual std::function<SegmentList()> previewTask(ImageColor const & image, double scale) const;
+   virtual bool setParameter(QString const & key, QString const & value);
+   virtual QString parameterKey() const;
 
 protected:
-   QDoubleSpinBox * sigmaPos;
-   QDoubleSpinBox * sigmaCol;
-   QSpinBox * minSize;
-   QDoubleSpinBox * epsilonShift;
-   QDoubleSpinBox * epsilonMerge;
-
-   void populateSettingsLayout();
-   ImageColor filter(ImageColor const & image) const;
+   MeanShiftParameters parameters;
+
+   virtual void populateSettingsLayout();
+   SegmentList decomposePreview(ImageColor const & image, MeanShiftParameters const & params) const;
+   ImageColor filter(ImageColor const & image, QByteArray const & imageKey,
+                     MeanShiftParameters const & params) const;
    SegmentList labelRegions(ImageColor const & filtered,
-                            ImageColor const & image) const;
+                            ImageColor const & image, QByteArray const & imageKey,
+                            MeanShiftParameters const & params) const;
 };
 
 struct FilterData {
@@ -35,6 +45,10 @@ struct FilterData {
    double sigmaPos;
    double sigmaCol;
    double epsSquared;
+   RunControl * control;
+#ifdef TIDY_STATS
+   Stats * stats;
+#endif
 };
 
 Pixel filterMT(FilterData const & data);
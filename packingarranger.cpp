@@ -0,0 +1,239 @@
+#include "packingarranger.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <QDir>
+#include <QDoubleSpinBox>
+#include <QFile>
+#include <QFormLayout>
+#include <QTextStream>
+#include <QTime>
+#include "distancefield.h"
+#include "layoutstate.h"
+#include "segment.h"
+#include "segmentlist.h"
+#include "stats.h"
+#include "trace.h"
+
+PackingArranger::PackingArranger() :
+   Arranger("Packing arranger")
+{
+}
+
+Arrangement PackingArranger::arrange(SegmentList const & segments) const {
+   PackingParameters const params = parameters;
+   TraceSpan const span("PackingArranger::arrange");
+
+   // determine background
+   Segment * background = determineBackground(segments);
+   SegmentList segmentsWOBack = removeBackground(segments, background);
+   segmentsWOBack.calculateFeatureVariances();
+
+   // initialize layout
+   LayoutState layout(segmentsWOBack);
+   initializeLayout(layout, params.xAxis, params.yAxis);
+
+   // pack layout
+   int const residual = packLayout(layout, params.xAxis, params.yAxis, params.cellSize);
+   qDebug("  Unplaced segments: %d", residual);
+
+   // the scene is built in the gui thread
+   return Arrangement{layout, background->color().toQRgb()};
+}
+
+void PackingArranger::arrangeBatch(SegmentList const & segments, QString const & name) const {
+   TraceSpan const span("PackingArranger::arrangeBatch");
+   PackingParameters const params = parameters;
+   QDir dir;
+   dir.mkpath(name + "/PackingArranger");
+
+   QFile file(name + "/PackingArranger" + "/output.txt");
+   file.open(QFile::WriteOnly | QFile::Truncate);
+   QTextStream out(&file);
+
+   // determine background
+   Segment * background = determineBackground(segments);
+   SegmentList segmentsWOBack = removeBackground(segments, background);
+   segmentsWOBack.calculateFeatureVariances();
+   out << "Feature Suggestion:" << endl;
+   out << "   x = " << FeatureVector::toString(segmentsWOBack.featX()) << endl;
+   out << "   y = " << FeatureVector::toString(segmentsWOBack.featY()) << endl;
+   out << endl;
+
+   // arrange the feature pairs concurrently, each on its own layout
+   double const cellSize = params.cellSize;
+   auto arrangePair = [this, &segmentsWOBack, cellSize](int i, int j, BatchResult const *) {
+      BatchResult result{i, j, QString(), QList<LayoutState>(), 0};
+      QTextStream log(&result.log);
+      log << "Arrangement:" << endl;
+      log << "   x = " << FeatureVector::toString(i) << endl;
+      log << "   y = " << FeatureVector::toString(j) << endl;
+
+      // initialize layout
+      LayoutState layout(segmentsWOBack);
+      initializeLayout(layout, i, j);
+
+      // pack layout
+      QTime time;
+      time.start();
+      int const residual = packLayout(layout, i, j, cellSize);
+      log << "   Arrangement packed in " << time.elapsed()/1000.0 << " seconds" << endl;
+      log << "   Unplaced segments: " << residual << endl;
+      log << endl;
+      log.flush();
+
+      result.layouts << layout;
+      result.residual = residual;
+      return result;
+   };
+
+   // write the results in order
+   auto finishPair = [this, &out, &name, background](BatchResult const & result) {
+      out << result.log;
+
+      // composite the layout without going through a QGraphicsScene
+      saveLayout(result.layouts.first(), background->color().toQRgb(),
+                 name + "/PackingArranger" +
+                 QString("/%1_%2.png").arg(FeatureVector::toString(result.featX))
+                                      .arg(FeatureVector::toString(result.featY)));
+   };
+
+   sweepFeaturePairs(arrangePair, finishPair);
+
+   file.close();
+}
+
+int PackingArranger::packLayout(LayoutState & layout, int featX, int featY, double cellSize) const {
+   TraceSpan const span("PackingArranger::packLayout");
+   if (layout.isEmpty()) {
+      return 0;
+   }
+
+   // place the segments in the order of the feature axes
+   int const count = layout.size();
+   QVector<int> order(count);
+   for (int i=0; i<count; ++i) {
+      order[i] = i;
+   }
+   std::stable_sort(order.begin(), order.end(), [&layout, featX, featY](int a, int b) {
+      FeatureVector const & fa = layout.segment(a)->features();
+      FeatureVector const & fb = layout.segment(b)->features();
+      return fa[featX] < fb[featX] || (fa[featX] == fb[featX] && fa[featY] < fb[featY]);
+   });
+
+   // footprints on the occupancy grid and their extent
+   QVector<QVector<QPoint>> footprints(count);
+   QVector<double> radii(count);
+   int extent = 0;
+   for (int i=0; i<count; ++i) {
+      footprints[i] = layout.segment(order.at(i))->footprint(layout.placement(order.at(i)), cellSize);
+      foreach (QPoint const & cell, footprints.at(i)) {
+         radii[i] = std::max(radii.at(i), std::sqrt(double(cell.x()*cell.x() + cell.y()*cell.y())));
+         extent = std::max(extent, std::max(std::abs(cell.x()), std::abs(cell.y())));
+      }
+   }
+
+   // the grid covers the targets with room for the biggest segment on each side
+   QRectF const targets = layout.rect();
+   Position const origin(std::floor(targets.left()/cellSize - extent - 1) * cellSize,
+                         std::floor(targets.top()/cellSize - extent - 1) * cellSize);
+   int const width = int(std::ceil(targets.width()/cellSize)) + 2*extent + 3;
+   int const height = int(std::ceil(targets.height()/cellSize)) + 2*extent + 3;
+   QVector<bool> occupied(width*height, false);
+   DistanceField free;
+
+   auto fits = [&](QVector<QPoint> const & footprint, int x, int y) {
+      TIDY_COUNT(PackingFitTests, 1);
+      foreach (QPoint const & cell, footprint) {
+         int const cx = x + cell.x();
+         int const cy = y + cell.y();
+         if (cx < 0 || cy < 0 || cx >= width || cy >= height || occupied.at(cy*width + cx)) {
+            return false;
+         }
+      }
+      return true;
+   };
+
+   int unplaced = 0;
+   for (int i=0; i<count; ++i) {
+      // a canceled run leaves the remaining segments at their targets
+      if (canceled()) {
+         unplaced += count-i;
+         break;
+      }
+      int const k = order.at(i);
+      QVector<QPoint> const & footprint = footprints.at(i);
+      double const tx = (layout.position(k).x - origin.x) / cellSize;
+      double const ty = (layout.position(k).y - origin.y) / cellSize;
+      int const cx = std::min(width-1, std::max(0, int(std::floor(tx))));
+      int const cy = std::min(height-1, std::max(0, int(std::floor(ty))));
+      int const maxRing = std::max(std::max(cx, width-1-cx), std::max(cy, height-1-cy));
+
+      // search rings of cells around the target until no closer free position is possible
+      int bestX = -1;
+      int bestY = -1;
+      double bestDist = std::numeric_limits<double>::max();
+      double dist;
+      for (int r=0; r<=maxRing; ++r) {
+         for (int y=std::max(extent, cy-r); y<=std::min(height-1-extent, cy+r); ++y) {
+            for (int x=std::max(extent, cx-r); x<=std::min(width-1-extent, cx+r); ++x) {
+               if (std::max(std::abs(x-cx), std::abs(y-cy)) != r) continue;
+               dist = (x-tx)*(x-tx) + (y-ty)*(y-ty);
+               if (dist >= bestDist) continue;
+               // far enough from all occupied cells, or checked cell by cell (the
+               // margin of the grid keeps every footprint inside); the 1/sqrt(2)
+               // chamfer distance overestimates the euclidean one by up to 8.24%
+               if ((!free.isNull() && free.at(x, y) > radii.at(i)*1.0824 + 1.5) || fits(footprint, x, y)) {
+                  bestDist = dist;
+                  bestX = x;
+                  bestY = y;
+               }
+            }
+         }
+         if (bestX >= 0 && bestDist <= double(r)*double(r)) {
+            break;
+         }
+      }
+
+      if (bestX < 0) {
+         // no room left, leave the segment at its target
+         ++unplaced;
+         continue;
+      }
+
+      // occupy the cells and update the distances to them
+      layout.setPosition(k, origin + Position(bestX, bestY) * cellSize);
+      foreach (QPoint const & cell, footprint) {
+         occupied[(bestY + cell.y())*width + bestX + cell.x()] = true;
+      }
+      free = DistanceField(width, height, occupied);
+   }
+
+   return unplaced;
+}
+
+void PackingArranger::populateSettingsLayout() {
+   populateAxisSettings(parameters);
+
+   QDoubleSpinBox * cellSizeBox = new QDoubleSpinBox();
+   cellSizeBox->setRange(1.0, 16.0);
+   cellSizeBox->setValue(parameters.cellSize);
+   cellSizeBox->setSuffix(" px");
+   cellSizeBox->setToolTip(QObject::tr("The size of a cell of the occupancy grid (smaller packs tighter but slower)"));
+   QObject::connect(cellSizeBox, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+                    [this](double value) { parameters.cellSize = value; });
+   settingsLayout->addRow(QObject::tr("Grid cell"), cellSizeBox);
+}
+
+bool PackingArranger::setParameter(QString const & key, QString const & value) {
+   if (key == "cellSize") {
+      bool ok;
+      double const cellSize = value.toDouble(&ok);
+      if (!ok) {
+         return false;
+      }
+      parameters.cellSize = qBound(1.0, cellSize, 16.0);
+      return true;
+   }
+   return setArrangerParameter(parameters, key, value);
+}
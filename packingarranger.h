@@ -0,0 +1,25 @@
+#ifndef PACKINGARRANGER_H
+#define PACKINGARRANGER_H
+
+#include "arranger.h"
+
+struct PackingParameters : ArrangerParameters {
+   double cellSize = 2.0;
+};
+
+class PackingArranger : public Arranger {
+
+public:
+   PackingArranger();
+   virtual Arrangement arrange(SegmentList const & segments) const;
+   virtual void arrangeBatch(SegmentList const & segments, QString const & name) const;
+   virtual bool setParameter(QString const & key, QString const & value);
+
+private:
+   PackingParameters parameters;
+
+   int packLayout(LayoutState & layout, int featX, int featY, double cellSize) const;
+   virtual void populateSettingsLayout();
+};
+
+#endif // PACKINGARRANGER_H
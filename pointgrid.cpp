@@ -0,0 +1,85 @@
+#include "pointgrid.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+PointGrid::PointGrid(QVector<Position> const & points, double cellSize) :
+   points(points), cellSize(std::max(1.0, cellSize)),
+   minX(0), minY(0), maxX(-1), maxY(-1)
+{
+   int x, y;
+   for (int i=0; i<points.size(); ++i) {
+      x = cell(points.at(i).x);
+      y = cell(points.at(i).y);
+      cells[QPair<int, int>(x, y)] << i;
+
+      if (i == 0) {
+         minX = maxX = x;
+         minY = maxY = y;
+      }
+      else {
+         minX = std::min(minX, x);
+         minY = std::min(minY, y);
+         maxX = std::max(maxX, x);
+         maxY = std::max(maxY, y);
+      }
+   }
+}
+
+int PointGrid::cell(double coordinate) const {
+   return int(std::floor(coordinate / cellSize));
+}
+
+int PointGrid::nearest(Position const & pos, QVector<int> const & labels, int excludedLabel) const {
+   int const cx = cell(pos.x);
+   int const cy = cell(pos.y);
+   int const maxRing = std::max(std::max(cx-minX, maxX-cx), std::max(cy-minY, maxY-cy));
+   int best = -1;
+   double bestDist = std::numeric_limits<double>::max();
+   double dist;
+
+   // search rings of cells around the position until no closer point is possible
+   for (int r=0; r<=maxRing; ++r) {
+      for (int y=cy-r; y<=cy+r; ++y) {
+         for (int x=cx-r; x<=cx+r; ++x) {
+            if (std::max(std::abs(x-cx), std::abs(y-cy)) != r) continue;
+            auto it = cells.constFind(QPair<int, int>(x, y));
+            if (it == cells.constEnd()) continue;
+            foreach (int const i, it.value()) {
+               if (labels.at(i) == excludedLabel) continue;
+               dist = (points.at(i)-pos).magnitudeSquared();
+               if (dist < bestDist || (best >= 0 && dist == bestDist && labels.at(i) < labels.at(best))) {
+                  bestDist = dist;
+                  best = i;
+               }
+            }
+         }
+      }
+      if (best >= 0 && bestDist <= (r*cellSize)*(r*cellSize)) {
+         break;
+      }
+   }
+
+   return best;
+}
+
+QVector<int> PointGrid::within(Position const & center, double radiusSquared) const {
+   QVector<int> indices;
+   double const radius = sqrt(radiusSquared);
+
+   for (int y=cell(center.y-radius); y<=cell(center.y+radius); ++y) {
+      for (int x=cell(center.x-radius); x<=cell(center.x+radius); ++x) {
+         auto it = cells.constFind(QPair<int, int>(x, y));
+         if (it == cells.constEnd()) continue;
+         foreach (int const i, it.value()) {
+            if ((points.at(i)-center).magnitudeSquared() < radiusSquared) {
+               indices << i;
+            }
+         }
+      }
+   }
+
+   // keep the order of a linear scan
+   std::sort(indices.begin(), indices.end());
+   return indices;
+}
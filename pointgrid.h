@@ -0,0 +1,29 @@
+#ifndef POINTGRID_H
+#define POINTGRID_H
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include "pixel.h"
+
+class PointGrid {
+
+public:
+   PointGrid(QVector<Position> const & points, double cellSize);
+
+   QVector<int> within(Position const & center, double radiusSquared) const;
+   int nearest(Position const & pos, QVector<int> const & labels, int excludedLabel) const;
+
+private:
+   QVector<Position> const & points;
+   double cellSize;
+   QHash<QPair<int, int>, QVector<int>> cells;
+   int minX;
+   int minY;
+   int maxX;
+   int maxY;
+
+   int cell(double coordinate) const;
+};
+
+#endif // POINTGRID_H
@@ -0,0 +1,37 @@
+#include "runcontrol.h"
+#include <algorithm>
+
+RunControl::RunControl(QObject * parent) :
+   QObject(parent), canceled(0), maximum(0), value(0)
+{
+}
+
+void RunControl::advance(int steps) {
+   // called from the workers, only every percent is signalled (queued to the gui)
+   int const max = maximum.load();
+   int const old = value.fetchAndAddRelaxed(steps);
+   if (max > 0 && (old+steps)*100/max != old*100/max) {
+      emit progressChanged(std::min(old+steps, max));
+   }
+}
+
+void RunControl::cancel() {
+   canceled.store(1);
+}
+
+bool RunControl::isCanceled() const {
+   return canceled.load() != 0;
+}
+
+void RunControl::reset() {
+   canceled.store(0);
+   maximum.store(0);
+   value.store(0);
+}
+
+void RunControl::setStage(QString const & stage, int maximum) {
+   // a maximum of zero shows a busy indicator
+   this->maximum.store(maximum);
+   value.store(0);
+   emit stageChanged(stage, maximum);
+}
@@ -0,0 +1,33 @@
+#ifndef RUNCONTROL_H
+#define RUNCONTROL_H
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QString>
+
+class RunControl : public QObject {
+
+   Q_OBJECT
+
+public:
+   explicit RunControl(QObject * parent = 0);
+
+   void advance(int steps = 1);
+   bool isCanceled() const;
+   void reset();
+   void setStage(QString const & stage, int maximum = 0);
+
+public slots:
+   void cancel();
+
+signals:
+   void stageChanged(QString const & stage, int maximum);
+   void progressChanged(int value);
+
+private:
+   QAtomicInt canceled;
+   QAtomicInt maximum;
+   QAtomicInt value;
+};
+
+#endif // RUNCONTROL_H
@@ -1,18 +1,29 @@
 #include "segment.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <QAtomicInteger>
 #include <QGraphicsPixmapItem>
-#include <QPainter>
+#include <QImage>
 #include <QPixmap>
+#include <QRegion>
 #include "image.h"
+#include "layoutstate.h"
 #include "pixel.h"
+#include "stats.h"
+
+static QAtomicInteger<quint64> nextId(1);
 
 Segment::Segment() :
-   _angle(0.0), _originalAngle(0.0), _scale(0.75)
+   _id(nextId.fetchAndAddRelaxed(1)), _originalAngle(0.0)
 {
+   trackMemory();
 }
 
 Segment::Segment(Color const & color, QList<Pixel *> pixels) :
-   _angle(0.0), _originalAngle(0.0), _scale(0.75), _color(color), _pixels(pixels)
+   _id(nextId.fetchAndAddRelaxed(1)), _originalAngle(0.0), _color(color), _pixels(pixels)
 {
+   trackMemory();
 }
 
 Segment::~Segment() {
@@ -20,26 +31,32 @@ Segment::~Segment() {
       delete pixel;
    }
    _pixels.clear();
+   TIDY_RELEASE(SegmentMemory, _segmentBytes);
+   TIDY_RELEASE(NeighbourMemory, _neighbourBytes);
+   TIDY_RELEASE(ShapeMemory, _shapeBytes);
 }
 
 void Segment::addNeighbour(Segment * neighbour) {
    if (neighbour && neighbour != this) {
       _neighbours.insert(neighbour);
+      trackMemory();
    }
 }
 
 void Segment::addPixel(Pixel * pixel) {
    _pixels << pixel;
-}
-
-double Segment::angle() const {
-   return _angle + _originalAngle;
+   _sprite = QImage();
+   trackMemory();
 }
 
 int Segment::area() const {
    return _pixels.size();
 }
 
+QRectF Segment::boundingRect(Placement const & placement) const {
+   return transform(placement).mapRect(_localRect);
+}
+
 void Segment::calculateColor() {
    _color = Color();
    if (!_pixels.isEmpty()) {
@@ -67,13 +84,58 @@ void Segment::calculateColorFeatures() {
 }
 
 void Segment::calculateContour() {
-   // Paint the segment into a QPixmap
-   QPixmap pixmap = toQPixmap();
+   // the opaque runs of the sprite rows, like the shape of a pixmap item
+   // but without a QPixmap (and therefore without a gui application)
+   QImage const sprite = toQImage();
+   QVector<QRect> runs;
+   int begin;
+   for (int y=0; y<sprite.height(); ++y) {
+      QRgb const * const line = reinterpret_cast<QRgb const *>(sprite.constScanLine(y));
+      for (int x=0; x<sprite.width(); ++x) {
+         if (qAlpha(line[x]) > 0) {
+            begin = x;
+            while (x+1 < sprite.width() && qAlpha(line[x+1]) > 0) ++x;
+            runs << QRect(begin, y, x-begin+1, 1);
+         }
+      }
+   }
+   QRegion region;
+   region.setRects(runs.constData(), runs.size());
+   QPainterPath path;
+   path.addRegion(region);
+   contour = path.translated(_minPos.x, _minPos.y);
+   trackMemory();
+}
 
-   // create a QGraphicsPixmapItem
-   QGraphicsPixmapItem * pixmapItem = new QGraphicsPixmapItem(pixmap);
-   pixmapItem->setOffset(_minPos.x, _minPos.y);
-   contour = pixmapItem->shape();
+void Segment::calculateDistanceField() {
+   // rasterize the segment with a margin of two pixels
+   int const margin = 2;
+   _fieldOrigin = _minPos - Position(margin, margin);
+   int const width = qRound(_maxPos.x-_minPos.x)+1 + 2*margin;
+   int const height = qRound(_maxPos.y-_minPos.y)+1 + 2*margin;
+   QVector<bool> inside(width*height, false);
+   foreach (Pixel const * const pixel, _pixels) {
+      inside[qRound(pixel->pos.y-_fieldOrigin.y)*width + qRound(pixel->pos.x-_fieldOrigin.x)] = true;
+   }
+   _distanceField = DistanceField(width, height, inside);
+
+   // gather the boundary pixels, at most 64 of them are used as probes
+   QVector<Position> boundary;
+   for (int y=1; y<height-1; ++y) {
+      for (int x=1; x<width-1; ++x) {
+         if (inside.at(y*width + x) &&
+             (!inside.at(y*width + x-1) || !inside.at(y*width + x+1) ||
+              !inside.at((y-1)*width + x) || !inside.at((y+1)*width + x))) {
+            boundary << Position(x, y) + _fieldOrigin;
+         }
+      }
+   }
+   int const stride = boundary.size()/64 + 1;
+   _outline.clear();
+   for (int i=0; i<boundary.size(); i+=stride) {
+      _outline << boundary.at(i);
+   }
+   trackMemory();
 }
 
 double Segment::calculatePrincipalAxisAngle() {
@@ -103,6 +165,12 @@ double Segment::calculatePrincipalAxisAngle() {
    return acos(_principalAxis.x);
 }
 
+void Segment::calculateSprite() {
+   // the pixels do not change after preparation, so the sprite is built only once
+   _sprite = rasterize();
+   trackMemory();
+}
+
 void Segment::calculateSpatialFeatures() {
    // get size
    _features[SIZE] = log(_pixels.size());
@@ -120,21 +188,11 @@ void Segment::calculateSpatialFeatures() {
    _features[ANGLE] = calculatePrincipalAxisAngle();
 }
 
-bool Segment::collides(Segment const * const other, Position const & offset) const {
-   QTransform transA;
-   transA.translate(_pos.x, _pos.y);
-   transA.translate(offset.x, offset.y);
-   transA.rotate(_angle * 57.295779513);
-   transA.scale(_scale, _scale);
-
-   QTransform transB;
-   transB.translate(other->_pos.x, other->_pos.y);
-   transB.rotate(other->_angle * 57.295779513);
-   transB.scale(other->_scale, other->_scale);
-
-   //QPainterPath pathA = transA.map(a->shape());
-   QPainterPath pathA = transA.map(contour);
-   QPainterPath pathB = transB.map(other->contour);
+bool Segment::collides(Placement const & placement,
+                       Segment const * const other, Placement const & otherPlacement) const {
+   //QPainterPath pathA = transform(placement).map(a->shape());
+   QPainterPath pathA = transform(placement).map(contour);
+   QPainterPath pathB = transform(otherPlacement).map(other->contour);
 
    return pathA.intersects(pathB);
 }
@@ -145,8 +203,8 @@ Color const & Segment::color() const {
 
 void Segment::copyToImage(Image<Color> & image, Position const & offset, bool averageColor) const {
    foreach (Pixel const * pixel, _pixels) {
-      image.at(qRound(pixel->pos.x + _pos.x + offset.x),
-               qRound(pixel->pos.y + _pos.y + offset.y))
+      image.at(qRound(pixel->pos.x + _origin.x + offset.x),
+               qRound(pixel->pos.y + _origin.y + offset.y))
             = averageColor?_color:pixel->col;
    }
 }
@@ -159,10 +217,38 @@ FeatureVector const & Segment::features() const {
    return _features;
 }
 
+QVector<QPoint> Segment::footprint(Placement const & placement, double cellSize) const {
+   // cells of a grid touched by the rotated and scaled pixels, relative to the position
+   QTransform const trans = transform(Placement{Position(), placement.angle, placement.scale});
+   double const half = 0.5 * placement.scale;
+   QVector<QPoint> cells;
+   QPointF point;
+   foreach (Pixel const * const pixel, _pixels) {
+      point = trans.map(QPointF(pixel->pos.x, pixel->pos.y));
+      for (int y=int(std::floor((point.y()-half)/cellSize)); y<=int(std::floor((point.y()+half)/cellSize)); ++y) {
+         for (int x=int(std::floor((point.x()-half)/cellSize)); x<=int(std::floor((point.x()+half)/cellSize)); ++x) {
+            cells << QPoint(x, y);
+         }
+      }
+   }
+
+   // row by row, without duplicates
+   std::sort(cells.begin(), cells.end(), [](QPoint const & a, QPoint const & b) {
+      return a.y() < b.y() || (a.y() == b.y() && a.x() < b.x());
+   });
+   cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+   return cells;
+}
+
+quint64 Segment::id() const {
+   return _id;
+}
+
 void Segment::merge(Segment * other) {
    // merge the other segment into this
    _color = (_color*area() + other->_color*other->area())/double(area()+other->area());
    _pixels.append(other->_pixels);  // position is not taken into account!
+   _sprite = QImage();
    _neighbours.unite(other->_neighbours);
    _neighbours.remove(this);
    _neighbours.remove(other);
@@ -176,27 +262,90 @@ void Segment::merge(Segment * other) {
    // clean the other segment
    other->_pixels.clear();
    other->_neighbours.clear();
+   trackMemory();
+   other->trackMemory();
 }
 
 const QSet<Segment *> & Segment::neighbours() const {
    return _neighbours;
 }
 
-Position const & Segment::position() const {
-   return _pos;
+Position const & Segment::origin() const {
+   return _origin;
+}
+
+double Segment::originalAngle() const {
+   return _originalAngle;
+}
+
+double Segment::penetration(Placement const & placement,
+                            Segment const * const other, Placement const & otherPlacement,
+                            Position & normal) const {
+   double depth = 0.0;
+   double d;
+   Position gradient;
+   QPointF point;
+
+   // probe the outline of this segment against the field of the other one
+   QTransform const toOther = transform(placement) * transform(otherPlacement).inverted();
+   foreach (Position const & probe, _outline) {
+      point = toOther.map(QPointF(probe.x, probe.y));
+      d = -other->_distanceField.sample(Position(point.x(), point.y()) - other->_fieldOrigin) * otherPlacement.scale;
+      if (d > depth) {
+         gradient = other->_distanceField.gradient(Position(point.x(), point.y()) - other->_fieldOrigin);
+         if (gradient.magnitudeSquared() > 0.0) {
+            depth = d;
+            normal = rotated(gradient, otherPlacement.angle).normalized();
+         }
+      }
+   }
+
+   // probe the outline of the other segment against the field of this one
+   QTransform const toThis = transform(otherPlacement) * transform(placement).inverted();
+   foreach (Position const & probe, other->_outline) {
+      point = toThis.map(QPointF(probe.x, probe.y));
+      d = -_distanceField.sample(Position(point.x(), point.y()) - _fieldOrigin) * placement.scale;
+      if (d > depth) {
+         gradient = _distanceField.gradient(Position(point.x(), point.y()) - _fieldOrigin);
+         if (gradient.magnitudeSquared() > 0.0) {
+            depth = d;
+            normal = -rotated(gradient, placement.angle).normalized();
+         }
+      }
+   }
+
+   return depth;
+}
+
+QList<Pixel *> const & Segment::pixels() const {
+   return _pixels;
+}
+
+QImage Segment::rasterize() const {
+   // premultiplied sprite, written scanline by scanline from the pixels (the extent is
+   // rounded like the pixel indices, a float difference may fall just below a whole number)
+   QImage image(qRound(_maxPos.x-_minPos.x)+1, qRound(_maxPos.y-_minPos.y)+1,
+                QImage::Format_ARGB32_Premultiplied);
+   image.fill(0);
+   QRgb * line;
+   foreach (Pixel const * pixel, _pixels) {
+      line = reinterpret_cast<QRgb *>(image.scanLine(qRound(pixel->pos.y - _minPos.y)));
+      line[qRound(pixel->pos.x - _minPos.x)] = pixel->col.toQRgb();
+   }
+   return image;
 }
 
 void Segment::relativizePosition() {
    // calculate center
-   _pos = Position();
+   _origin = Position();
    foreach (Pixel const * const pixel, _pixels) {
-      _pos += pixel->pos;
+      _origin += pixel->pos;
    }
-   _pos /= _pixels.size();
+   _origin /= _pixels.size();
 
    // convert pixel positions from absolute to relative
    foreach (Pixel * const pixel, _pixels) {
-      pixel->pos -= _pos;
+      pixel->pos -= _origin;
    }
 
    // determin minimal and maximal positions (relative)
@@ -208,57 +357,106 @@ void Segment::relativizePosition() {
       _maxPos.x = std::max(_maxPos.x, pixel->pos.x);
       _maxPos.y = std::max(_maxPos.y, pixel->pos.y);
    }
+
+   // same extent as the sprite created by toQImage()
+   _localRect = QRectF(_minPos.x, _minPos.y,
+                       qRound(_maxPos.x-_minPos.x)+1, qRound(_maxPos.y-_minPos.y)+1);
 }
 
 void Segment::removeNeighbour(Segment * neighbour) {
    _neighbours.remove(neighbour);
+   trackMemory();
 }
 
-void Segment::resetAngle() {
-   _angle = 0.0;
+Position Segment::rotated(Position const & vec, double angle) {
+   double const c = cos(angle);
+   double const s = sin(angle);
+   return Position(c*vec.x - s*vec.y, s*vec.x + c*vec.y);
 }
 
-Segment & Segment::rotate(double alpha) {
-   _angle += alpha;
-   return *this;
-}
+int Segment::silhouette(Placement const & placement, QVector<double> & top, QVector<double> & bottom) const {
+   // columns of the rotated and scaled segment, relative to its position
+   QTransform const trans = transform(Placement{Position(), placement.angle, placement.scale});
+   QRectF const rect = trans.mapRect(_localRect);
+   int const left = int(std::floor(rect.left()));
+   int const width = int(std::floor(rect.right())) - left + 1;
+   double const half = 0.5 * placement.scale;
+   top.fill(std::numeric_limits<double>::max(), width);
+   bottom.fill(-std::numeric_limits<double>::max(), width);
+   QPointF point;
+   int column;
+   foreach (Pixel const * const pixel, _pixels) {
+      point = trans.map(QPointF(pixel->pos.x, pixel->pos.y));
+      column = std::min(width-1, std::max(0, int(std::floor(point.x())) - left));
+      top[column] = std::min(top.at(column), point.y() - half);
+      bottom[column] = std::max(bottom.at(column), point.y() + half);
+   }
 
-void Segment::setAngle(double angle) {
-   _angle = angle - _originalAngle;
+   // rotated pixels may skip a column, close such gaps with the left neighbour (the
+   // leading columns with the first filled one)
+   int first = 0;
+   while (first < width && top.at(first) > bottom.at(first)) {
+      ++first;
+   }
+   if (first == width) {
+      top.fill(0.0);
+      bottom.fill(0.0);
+      return left;
+   }
+   for (int c=0; c<first; ++c) {
+      top[c] = top.at(first);
+      bottom[c] = bottom.at(first);
+   }
+   for (int c=first+1; c<width; ++c) {
+      if (top.at(c) > bottom.at(c)) {
+         top[c] = top.at(c-1);
+         bottom[c] = bottom.at(c-1);
+      }
+   }
+   return left;
 }
 
-void Segment::setPosition(Position const & position) {
-   _pos = position;
+QTransform Segment::spriteTransform(Placement const & placement) const {
+   // from the pixels of toQImage() to the arrangement
+   return QTransform::fromTranslate(_minPos.x, _minPos.y) * transform(placement);
 }
 
-QGraphicsItem * Segment::toQGraphicsItem() const {
-   // Paint the segment into a QPixmap
-   QPixmap pixmap = toQPixmap();
-
-   // create a QGraphicsPixmapItem
-   QGraphicsPixmapItem * pixmapItem = new QGraphicsPixmapItem(pixmap);
+QGraphicsItem * Segment::toQGraphicsItem(Placement const & placement) const {
+   // create a QGraphicsPixmapItem from the sprite
+   QGraphicsPixmapItem * pixmapItem = new QGraphicsPixmapItem(QPixmap::fromImage(toQImage()));
    pixmapItem->setTransformationMode(Qt::SmoothTransformation);
    pixmapItem->setOffset(_minPos.x, _minPos.y);
-   pixmapItem->setPos(_pos.x, _pos.y);
-   pixmapItem->setRotation(_angle*57.295779513);
-   pixmapItem->setScale(_scale);
+   pixmapItem->setPos(placement.pos.x, placement.pos.y);
+   pixmapItem->setRotation(placement.angle*57.295779513);
+   pixmapItem->setScale(placement.scale);
 
    return pixmapItem;
 }
 
-QPixmap Segment::toQPixmap() const {
-   QPixmap pixmap(_maxPos.x-_minPos.x+1, _maxPos.y-_minPos.y+1);
-   pixmap.fill(QColor(0, 0, 0, 0));
-   QPainter painter(&pixmap);
-   foreach (Pixel const * pixel, _pixels) {
-      painter.setPen(QColor(pixel->col.toQRgb()));
-      painter.drawPoint(qRound(pixel->pos.x - _minPos.x),
-                        qRound(pixel->pos.y - _minPos.y));
-   }
-   return pixmap;
+QImage Segment::toQImage() const {
+   // segments that are not prepared yet are rasterized on the fly
+   return _sprite.isNull() ? rasterize() : _sprite;
+}
+
+void Segment::trackMemory() {
+#ifdef TIDY_STATS
+   // estimates, every pixel is a separate allocation behind a list slot
+   Stats::track(Stats::SegmentMemory, _segmentBytes,
+                sizeof(Segment) + qint64(_pixels.size())*(sizeof(Pixel) + sizeof(Pixel *) + 16));
+   Stats::track(Stats::NeighbourMemory, _neighbourBytes,
+                qint64(_neighbours.size())*(sizeof(Segment *) + 16));
+   Stats::track(Stats::ShapeMemory, _shapeBytes,
+                qint64(contour.elementCount())*sizeof(QPainterPath::Element) +
+                qint64(_distanceField.width())*_distanceField.height()*sizeof(float) +
+                qint64(_outline.size())*sizeof(Position) +
+                qint64(_sprite.bytesPerLine())*_sprite.height());
+#endif
 }
 
-Segment & Segment::translate(Position vec) {
-   _pos += vec;
-   return *this;
+QTransform Segment::transform(Placement const & placement) {
+   QTransform trans;
+   trans.translate(placement.pos.x, placement.pos.y);
+   trans.rotate(placement.angle * 57.295779513);
+   trans.scale(placement.scale, placement.scale);
+   return trans;
 }
@@ -1,13 +1,18 @@
 #ifndef SEGMENT_H
 #define SEGMENT_H
 
+#include <QPoint>
 #include <QSet>
+#include <QImage>
 #include <QPainterPath>
+#include <QTransform>
+#include "distancefield.h"
 #include "pixel.h"
 #include "featurevector.h"
 #include "image.forward.h"
 
 class QGraphicsItem;
+struct Placement;
 
 class Segment {
 
@@ -16,19 +21,16 @@ public:
    Segment(Color const & color, QList<Pixel *> pixels);
    ~Segment();
 
-   Segment & translate(Position vec);
-   Segment & rotate(double alpha);
-
    int area() const;
-   double angle() const;
-   Position const & position() const;
+   quint64 id() const;
+   double originalAngle() const;
+   Position const & origin() const;
    Color const & color() const;
    FeatureVector & features();
    FeatureVector const & features() const;
    QSet<Segment *> const & neighbours() const;
+   QList<Pixel *> const & pixels() const;
 
-   void setPosition(Position const & position);
-   void setAngle(double angle);
    void addPixel(Pixel * pixel);
    void addNeighbour(Segment * neighbour);
    void removeNeighbour(Segment * neighbour);
@@ -39,28 +41,53 @@ public:
    void calculateSpatialFeatures();
    void calculateColorFeatures();
    void calculateContour();
-   void resetAngle();
+   void calculateDistanceField();
+   void calculateSprite();
    void copyToImage(Image<Color> & image, Position const & offset, bool averageColor = false) const;
 
-   bool collides(Segment const * const other, Position const & offset = Position()) const;
-   QGraphicsItem * toQGraphicsItem() const;
+   QVector<QPoint> footprint(Placement const & placement, double cellSize) const;
+   bool collides(Placement const & placement,
+                 Segment const * const other, Placement const & otherPlacement) const;
+   QRectF boundingRect(Placement const & placement) const;
+   double penetration(Placement const & placement,
+                      Segment const * const other, Placement const & otherPlacement,
+                      Position & normal) const;
+   int silhouette(Placement const & placement, QVector<double> & top, QVector<double> & bottom) const;
+   QTransform spriteTransform(Placement const & placement) const;
+   QGraphicsItem * toQGraphicsItem(Placement const & placement) const;
+   QImage toQImage() const;
 
 private:
-   double _angle;
+   // unique for the lifetime of the process, addresses are reused after a delete
+   quint64 _id;
    double _originalAngle;
-   double _scale;
-   Position _pos;
+   Position _origin;
    Position _minPos;
    Position _maxPos;
+   QRectF _localRect;
    Position _principalAxis;
    Color _color;
    QList<Pixel *> _pixels;
    QSet<Segment *> _neighbours;
    FeatureVector _features;
    QPainterPath contour;
+   DistanceField _distanceField;
+   Position _fieldOrigin;
+   QVector<Position> _outline;
+   QImage _sprite;
+#ifdef TIDY_STATS
+   // the heap reported to the stats
+   qint64 _segmentBytes = 0;
+   qint64 _neighbourBytes = 0;
+   qint64 _shapeBytes = 0;
+#endif
 
    double calculatePrincipalAxisAngle();
-   QPixmap toQPixmap() const;
+   QImage rasterize() const;
+   void trackMemory();
+
+   static Position rotated(Position const & vec, double angle);
+   static QTransform transform(Placement const & placement);
 };
 
 #endif // SEGMENT_H
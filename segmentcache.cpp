@@ -0,0 +1,172 @@
+#include "segmentcache.h"
+#include <cstring>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+#include "decomposer.h"
+#include "image.h"
+#include "pixel.h"
+#include "segment.h"
+#include "segmentlist.h"
+#include "trace.h"
+
+SegmentCache::SegmentCache(QString const & directory) :
+   directory(directory)
+{
+}
+
+QString SegmentCache::defaultDirectory() {
+   return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/segments";
+}
+
+bool SegmentCache::isEnabled() const {
+   return !directory.isEmpty();
+}
+
+QByteArray SegmentCache::key(ImageColor const & image, Decomposer const & decomposer) {
+   // the decomposition depends on the image content, the decomposer and its parameters
+   QCryptographicHash hash(QCryptographicHash::Sha1);
+   hash.addData(QString("%1x%2;").arg(image.width()).arg(image.height()).toUtf8());
+   if (!image.isNull()) {
+      hash.addData(reinterpret_cast<char const *>(&image.at(0)), image.area()*sizeof(Color));
+   }
+   hash.addData(decomposer.getName().toUtf8());
+   hash.addData(decomposer.parameterKey().toUtf8());
+   return hash.result().toHex();
+}
+
+bool SegmentCache::load(QByteArray const & key, ImageColor const & image, SegmentList & segments) const {
+   TraceSpan const span("SegmentCache::load");
+   if (!isEnabled()) {
+      return false;
+   }
+   QFile file(path(key));
+   if (!file.open(QFile::ReadOnly) || file.size() < qint64(sizeof(Header))) {
+      return false;
+   }
+   uchar * const data = file.map(0, file.size());
+   if (!data) {
+      return false;
+   }
+
+   // reject files of another layout or a different image size
+   Header const * const header = reinterpret_cast<Header const *>(data);
+   bool valid = memcmp(header->magic, "TSC1", 4) == 0 &&
+                header->width == image.width() && header->height == image.height() &&
+                header->segmentCount >= 0 && header->neighbourCount >= 0 &&
+                file.size() == qint64(sizeof(Header) + sizeof(qint32)*image.area() +
+                                      sizeof(SegmentRecord)*header->segmentCount +
+                                      sizeof(qint32)*header->neighbourCount);
+   if (!valid) {
+      file.unmap(data);
+      return false;
+   }
+   qint32 const * const labels = reinterpret_cast<qint32 const *>(data + sizeof(Header));
+   SegmentRecord const * const records = reinterpret_cast<SegmentRecord const *>(labels + image.area());
+   qint32 const * const neighbours = reinterpret_cast<qint32 const *>(records + header->segmentCount);
+
+   // the decomposers keep the colors of the original image in the pixels
+   QVector<QList<Pixel *>> pixels(header->segmentCount);
+   for (int i=0; i<image.area() && valid; ++i) {
+      valid = labels[i] >= 0 && labels[i] < header->segmentCount;
+      if (valid) {
+         pixels[labels[i]] << new Pixel(Position(i%image.width(), i/image.width()), image.at(i));
+      }
+   }
+   for (int s=0; s<header->segmentCount && valid; ++s) {
+      valid = !pixels.at(s).isEmpty() &&
+              records[s].firstNeighbour >= 0 && records[s].neighbourCount >= 0 &&
+              records[s].firstNeighbour + records[s].neighbourCount <= header->neighbourCount;
+   }
+   for (int n=0; n<header->neighbourCount && valid; ++n) {
+      valid = neighbours[n] >= 0 && neighbours[n] < header->segmentCount;
+   }
+   if (!valid) {
+      for (int s=0; s<pixels.size(); ++s) {
+         qDeleteAll(pixels.at(s));
+      }
+      file.unmap(data);
+      return false;
+   }
+
+   // rebuild the segments and their neighbourhood
+   SegmentList result;
+   for (int s=0; s<header->segmentCount; ++s) {
+      result << new Segment(Color(records[s].l99, records[s].a99, records[s].b99), pixels.at(s));
+   }
+   for (int s=0; s<header->segmentCount; ++s) {
+      for (int n=records[s].firstNeighbour; n<records[s].firstNeighbour+records[s].neighbourCount; ++n) {
+         result.at(s)->addNeighbour(result.at(neighbours[n]));
+      }
+   }
+   file.unmap(data);
+
+   segments = result;
+   return true;
+}
+
+QString SegmentCache::path(QByteArray const & key) const {
+   return directory + "/" + QString(key) + ".seg";
+}
+
+bool SegmentCache::store(QByteArray const & key, ImageColor const & image, SegmentList const & segments) const {
+   TraceSpan const span("SegmentCache::store");
+   if (!isEnabled()) {
+      return false;
+   }
+
+   // label every pixel with the index of its segment (the origin is zero until
+   // the segments are prepared, so this works before and after)
+   QHash<Segment const *, qint32> indices;
+   QVector<qint32> labels(image.area(), -1);
+   int x, y;
+   for (int s=0; s<segments.size(); ++s) {
+      indices.insert(segments.at(s), s);
+      foreach (Pixel const * const pixel, segments.at(s)->pixels()) {
+         x = qRound(pixel->pos.x + segments.at(s)->origin().x);
+         y = qRound(pixel->pos.y + segments.at(s)->origin().y);
+         if (x < 0 || x >= image.width() || y < 0 || y >= image.height()) {
+            return false;
+         }
+         labels[y*image.width() + x] = s;
+      }
+   }
+   foreach (qint32 const label, labels) {
+      if (label < 0) {
+         return false;
+      }
+   }
+
+   // segment table with the neighbours as index ranges
+   QVector<SegmentRecord> records;
+   QVector<qint32> neighbours;
+   int first;
+   foreach (Segment const * const segment, segments) {
+      first = neighbours.size();
+      foreach (Segment * const neighbour, segment->neighbours()) {
+         if (indices.contains(neighbour)) {
+            neighbours << indices.value(neighbour);
+         }
+      }
+      records << SegmentRecord{segment->color().l99, segment->color().a99, segment->color().b99,
+                               first, neighbours.size()-first};
+   }
+
+   // written to a temporary file first, concurrent readers never see a partial entry
+   QDir().mkpath(directory);
+   QSaveFile file(path(key));
+   if (!file.open(QFile::WriteOnly)) {
+      return false;
+   }
+   Header const header{{'T', 'S', 'C', '1'}, image.width(), image.height(),
+                       segments.size(), neighbours.size()};
+   file.write(reinterpret_cast<char const *>(&header), sizeof(Header));
+   file.write(reinterpret_cast<char const *>(labels.constData()), sizeof(qint32)*labels.size());
+   file.write(reinterpret_cast<char const *>(records.constData()), sizeof(SegmentRecord)*records.size());
+   file.write(reinterpret_cast<char const *>(neighbours.constData()), sizeof(qint32)*neighbours.size());
+   return file.commit();
+}
@@ -0,0 +1,46 @@
+#ifndef SEGMENTCACHE_H
+#define SEGMENTCACHE_H
+
+#include <QByteArray>
+#include <QString>
+#include "image.forward.h"
+
+class Decomposer;
+class SegmentList;
+
+class SegmentCache {
+
+public:
+   explicit SegmentCache(QString const & directory = defaultDirectory());
+
+   bool isEnabled() const;
+   bool load(QByteArray const & key, ImageColor const & image, SegmentList & segments) const;
+   bool store(QByteArray const & key, ImageColor const & image, SegmentList const & segments) const;
+
+   static QString defaultDirectory();
+   static QByteArray key(ImageColor const & image, Decomposer const & decomposer);
+
+private:
+   QString directory;
+
+   QString path(QByteArray const & key) const;
+
+   // file layout: header, label of every pixel, segment table, neighbour indices
+   struct Header {
+      char magic[4];
+      qint32 width;
+      qint32 height;
+      qint32 segmentCount;
+      qint32 neighbourCount;
+   };
+
+   struct SegmentRecord {
+      float l99;
+      float a99;
+      float b99;
+      qint32 firstNeighbour;
+      qint32 neighbourCount;
+   };
+};
+
+#endif // SEGMENTCACHE_H
@@ -1,8 +1,9 @@
 #include "segmentlist.h"
-#include <QGraphicsScene>
 #include "image.h"
 #include "segment.h"
+#include "trace.h"
 #include <QDebug>
+#include <QHash>
 
 int SegmentList::area() const {
    int area = 0;
@@ -14,21 +15,6 @@ int SegmentList::area() const {
    return area;
 }
 
-Position SegmentList::bottomCenter() const {
-   Position pos(0.0, std::numeric_limits<double>::max());
-   int area = 0;
-
-   foreach (Segment const * const segment, *this) {
-      pos.x += segment->position().x * segment->area();
-      area += segment->area();
-
-      pos.y = std::min(pos.y, segment->position().y);
-   }
-   pos.x /= double(area);
-
-   return pos;
-}
-
 void SegmentList::calculateFeatureVariances() {
    // calculate average features
    FeatureVector average;
@@ -77,17 +63,24 @@ void SegmentList::calculateMeanColors() {
    }
 }
 
-Position SegmentList::center() const {
-   Position pos;
-   int area = 0;
-
+SegmentList SegmentList::clone() const {
+   // deep copy of unprepared segments, the neighbours point into the copy
+   SegmentList copy;
+   QHash<Segment const *, Segment *> copies;
    foreach (Segment const * const segment, *this) {
-      pos += segment->position() * segment->area();
-      area += segment->area();
+      QList<Pixel *> pixels;
+      foreach (Pixel const * const pixel, segment->pixels()) {
+         pixels << new Pixel(*pixel);
+      }
+      copy << new Segment(segment->color(), pixels);
+      copies.insert(segment, copy.last());
    }
-   pos /= double(area);
-
-   return pos;
+   for (int i=0; i<size(); ++i) {
+      foreach (Segment * const neighbour, at(i)->neighbours()) {
+         copy.at(i)->addNeighbour(copies.value(neighbour));
+      }
+   }
+   return copy;
 }
 
 void SegmentList::copyToImageAVG(ImageColor & image) const {
@@ -111,14 +104,6 @@ int SegmentList::featY() const {
    return mostSigni[1];
 }
 
-void SegmentList::moveTo(Position const & newCenter) {
-   Position translation = newCenter - topCenter();
-
-   foreach (Segment * const segment, *this) {
-      segment->translate(translation);
-   }
-}
-
 void SegmentList::normalizeFeatures() {
    if (isEmpty()) return;
    FeatureVector min = at(0)->features();
@@ -136,49 +121,15 @@ void SegmentList::normalizeFeatures() {
 }
 
 void SegmentList::prepare() {
+   TraceSpan const span("SegmentList::prepare");
    foreach (Segment * const segment, *this) {
       segment->relativizePosition();
+      segment->calculateSprite();
       segment->calculateSpatialFeatures();
       segment->calculateColorFeatures();
       segment->calculateContour();
+      segment->calculateDistanceField();
    }
    normalizeFeatures();
    calculateFeatureVariances();
 }
-
-Position SegmentList::topCenter() const {
-   Position pos(0.0, std::numeric_limits<double>::min());
-   int area = 0;
-
-   foreach (Segment const * const segment, *this) {
-      pos.x += segment->position().x * segment->area();
-      area += segment->area();
-
-      pos.y = std::max(pos.y, segment->position().y);
-   }
-   pos.x /= double(area);
-
-   return pos;
-}
-
-void SegmentList::translate(Position const & translation) {
-   foreach (Segment * const segment, *this) {
-      segment->translate(translation);
-   }
-}
-
-QRectF SegmentList::rect() const {
-   QGraphicsScene scene;
-   foreach(Segment const * const segment, *this) {
-      scene.addItem(segment->toQGraphicsItem());
-      // without the following line QPainter tends to crash
-      scene.width();
-   }
-   return scene.sceneRect();
-}
-
-void SegmentList::resetAngles() {
-   foreach(Segment * const segment, *this) {
-      segment->resetAngle();
-   }
-}
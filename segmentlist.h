@@ -5,30 +5,22 @@
 #include "image.forward.h"
 
 class Segment;
-class Position;
 
 class SegmentList : public QList<Segment *> {
 
 public:
+   SegmentList clone() const;
    void deleteAndClear();
    void copyToImageAVG(ImageColor & image) const;
 
    void prepare();
    void calculateMeanColors();
    void calculateFeatureVariances();
-   void resetAngles();
 
    int area() const;
-   Position center() const;
-   Position bottomCenter() const;
-   Position topCenter() const;
-   QRectF rect() const;
    int featX() const;
    int featY() const;
 
-   void moveTo(Position const & newCenter);
-   void translate(Position const & translation);
-
 private:
    int mostSigni[2];
 
@@ -0,0 +1,116 @@
+#include "stagecache.h"
+#include <limits>
+#include <QCryptographicHash>
+#include "pixel.h"
+#include "segment.h"
+
+StageCache::StageCache(int maxMegaBytes) :
+   entries(maxMegaBytes << 10)
+{
+}
+
+StageCache::Entry::~Entry() {
+   segments.deleteAndClear();
+}
+
+bool StageCache::accepts(int cost) const {
+   // entries over the limit would only be copied to be dropped right away
+   QMutexLocker locker(&mutex);
+   return cost <= entries.maxCost();
+}
+
+bool StageCache::enabled() const {
+   QMutexLocker locker(&mutex);
+   return entries.maxCost() > 0;
+}
+
+bool StageCache::find(QByteArray const & key, ImageColor & image) const {
+   if (!enabled()) {
+      return false;
+   }
+   QMutexLocker locker(&mutex);
+   Entry const * const entry = entries.object(key);
+   if (!entry || entry->color.isNull()) {
+      return false;
+   }
+   image = ImageColor(entry->color);
+   return true;
+}
+
+bool StageCache::find(QByteArray const & key, ImageGray & image) const {
+   if (!enabled()) {
+      return false;
+   }
+   QMutexLocker locker(&mutex);
+   Entry const * const entry = entries.object(key);
+   if (!entry || entry->gray.isNull()) {
+      return false;
+   }
+   image = ImageGray(entry->gray);
+   return true;
+}
+
+bool StageCache::find(QByteArray const & key, SegmentList & segments) const {
+   // the caller merges the segments, so it gets its own copy
+   if (!enabled()) {
+      return false;
+   }
+   QMutexLocker locker(&mutex);
+   Entry const * const entry = entries.object(key);
+   if (!entry || entry->segments.isEmpty()) {
+      return false;
+   }
+   segments = entry->segments.clone();
+   return true;
+}
+
+QByteArray StageCache::imageKey(ImageColor const & image) {
+   QCryptographicHash hash(QCryptographicHash::Sha1);
+   hash.addData(QString("%1x%2;").arg(image.width()).arg(image.height()).toUtf8());
+   if (!image.isNull()) {
+      hash.addData(reinterpret_cast<char const *>(&image.at(0)), image.area()*sizeof(Color));
+   }
+   return hash.result().toHex();
+}
+
+void StageCache::insert(QByteArray const & key, ImageColor const & image) {
+   int const cost = std::max(1, int(qint64(image.area())*sizeof(Color) >> 10));
+   if (!accepts(cost)) {
+      return;
+   }
+   Entry * const entry = new Entry();
+   entry->color = ImageColor(image);
+   QMutexLocker locker(&mutex);
+   entries.insert(key, entry, cost);
+}
+
+void StageCache::insert(QByteArray const & key, ImageGray const & image) {
+   int const cost = std::max(1, int(qint64(image.area())*sizeof(Gray) >> 10));
+   if (!accepts(cost)) {
+      return;
+   }
+   Entry * const entry = new Entry();
+   entry->gray = ImageGray(image);
+   QMutexLocker locker(&mutex);
+   entries.insert(key, entry, cost);
+}
+
+void StageCache::insert(QByteArray const & key, SegmentList const & segments) {
+   // every pixel is a separate allocation
+   qint64 const bytes = qint64(segments.area())*(sizeof(Pixel) + sizeof(Pixel *) + 16) +
+                        segments.size()*sizeof(Segment);
+   int const cost = int(std::max(qint64(1), std::min(bytes >> 10, qint64(std::numeric_limits<int>::max()))));
+   if (!accepts(cost)) {
+      return;
+   }
+   Entry * const entry = new Entry();
+   entry->segments = segments.clone();
+   QMutexLocker locker(&mutex);
+   entries.insert(key, entry, cost);
+}
+
+void StageCache::setMaxMegaBytes(int maxMegaBytes) {
+   // zero turns the cache off
+   QMutexLocker locker(&mutex);
+   entries.setMaxCost(maxMegaBytes << 10);
+}
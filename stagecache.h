@@ -0,0 +1,44 @@
+#ifndef STAGECACHE_H
+#define STAGECACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QMutex>
+#include "image.h"
+#include "segmentlist.h"
+
+class StageCache {
+
+public:
+   static int const DefaultMegaBytes = 256;
+
+   explicit StageCache(int maxMegaBytes = DefaultMegaBytes);
+
+   bool find(QByteArray const & key, ImageColor & image) const;
+   bool find(QByteArray const & key, ImageGray & image) const;
+   bool find(QByteArray const & key, SegmentList & segments) const;
+   void insert(QByteArray const & key, ImageColor const & image);
+   void insert(QByteArray const & key, ImageGray const & image);
+   void insert(QByteArray const & key, SegmentList const & segments);
+   void setMaxMegaBytes(int maxMegaBytes);
+
+   static QByteArray imageKey(ImageColor const & image);
+
+private:
+   struct Entry {
+      ImageColor color;
+      ImageGray gray;
+      SegmentList segments;
+
+      ~Entry();
+   };
+
+   mutable QMutex mutex;
+   // least recently used entries are dropped first, the cost is in KiB
+   mutable QCache<QByteArray, Entry> entries;
+
+   bool accepts(int cost) const;
+   bool enabled() const;
+};
+
+#endif // STAGECACHE_H
@@ -0,0 +1,214 @@
+#include "stats.h"
+#include <algorithm>
+#include <QFile>
+#include <QTextStream>
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+static thread_local Stats * currentStats = nullptr;
+
+// the live bytes of the whole process, the last entry is the sum
+static QAtomicInteger<qint64> liveBytes[Stats::MemoryCount+1];
+
+static char const * const counterNames[Stats::CounterCount] = {
+   "meanShiftPixels",
+   "latticeCellsVisited",
+   "latticePixelsCompared",
+   "watershedMarkers",
+   "watershedDams",
+   "mergeRounds",
+   "merges",
+   "broadPhaseUpdates",
+   "broadPhaseRejections",
+   "collidesCalls",
+   "collisions",
+   "circlePasses",
+   "forceRefinements",
+   "forceIterations",
+   "forceBudgetsExhausted",
+   "residualCollisions",
+   "packingFitTests"
+};
+
+static char const * const histogramNames[Stats::HistogramCount] = {
+   "meanShiftIterations",
+   "watershedPlateauSize",
+   "forceIterationsPerRefinement"
+};
+
+static char const * const memoryNames[Stats::MemoryCount+1] = {
+   "images",
+   "workingSets",
+   "segments",
+   "neighbours",
+   "shapes",
+   "total"
+};
+
+static qint64 peakResidentBytes() {
+#ifdef Q_OS_UNIX
+   rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MACOS
+      return usage.ru_maxrss;
+#else
+      return qint64(usage.ru_maxrss) << 10;
+#endif
+   }
+#endif
+   return -1;
+}
+
+static qint64 residentBytes() {
+   // only linux tells the current size cheaply
+#ifdef Q_OS_LINUX
+   QFile file("/proc/self/statm");
+   if (file.open(QFile::ReadOnly)) {
+      QList<QByteArray> const fields = file.readAll().split(' ');
+      if (fields.size() > 1) {
+         return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+      }
+   }
+#endif
+   return -1;
+}
+
+void Stats::allocate(Memory memory, qint64 bytes) {
+   qint64 const live = liveBytes[memory].fetchAndAddRelaxed(bytes) + bytes;
+   qint64 const total = liveBytes[MemoryCount].fetchAndAddRelaxed(bytes) + bytes;
+   // a release cannot raise a peak
+   Stats * const stats = currentStats;
+   if (stats && bytes > 0) {
+      raise(stats->stagePeaks[memory], live);
+      raise(stats->stagePeaks[MemoryCount], total);
+   }
+}
+
+int Stats::bucket(qint64 value) {
+   if (value < 16) {
+      return int(std::max(value, qint64(0)));
+   }
+   int log = 4;
+   while (value >> (log+1)) {
+      ++log;
+   }
+   return 16 + log-4;
+}
+
+QString Stats::bucketName(int bucket) {
+   if (bucket < 16) {
+      return QString::number(bucket);
+   }
+   int const log = bucket-16 + 4;
+   return QString("%1-%2").arg(qint64(1) << log).arg((qint64(2) << log) - 1);
+}
+
+void Stats::closeStage() {
+   // called with the mutex locked, the peaks of the next stage start at the live bytes
+   if (stage.isEmpty()) {
+      return;
+   }
+   MemorySample snapshot;
+   snapshot.stage = stage;
+   for (int m=0; m<=MemoryCount; ++m) {
+      snapshot.live[m] = liveBytes[m].load();
+      snapshot.peak[m] = std::max(snapshot.live[m], stagePeaks[m].fetchAndStoreRelaxed(snapshot.live[m]));
+   }
+   snapshot.resident = residentBytes();
+   snapshot.peakResident = peakResidentBytes();
+   memorySamples << snapshot;
+   stage.clear();
+}
+
+void Stats::count(Counter counter, qint64 n) {
+   counters[counter].fetchAndAddRelaxed(n);
+}
+
+Stats * Stats::current() {
+   return currentStats;
+}
+
+void Stats::enterStage(QString const & stage) {
+   QMutexLocker locker(&mutex);
+   closeStage();
+   if (memorySamples.isEmpty()) {
+      for (int m=0; m<=MemoryCount; ++m) {
+         stagePeaks[m].store(liveBytes[m].load());
+      }
+   }
+   this->stage = stage;
+}
+
+void Stats::leaveStage() {
+   QMutexLocker locker(&mutex);
+   closeStage();
+}
+
+void Stats::raise(QAtomicInteger<qint64> & peak, qint64 value) {
+   qint64 current = peak.load();
+   while (value > current && !peak.testAndSetRelaxed(current, value, current)) {}
+}
+
+void Stats::sample(Histogram histogram, qint64 value) {
+   histograms[histogram][bucket(value)].fetchAndAddRelaxed(1);
+}
+
+bool Stats::save(QString const & filename) const {
+   // json, the histograms only list their filled buckets
+   QFile file(filename);
+   if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+      return false;
+   }
+   QTextStream out(&file);
+   out << "{\n   \"counters\": {";
+   for (int c=0; c<CounterCount; ++c) {
+      out << (c > 0 ? ",\n" : "\n") << "      \"" << counterNames[c] << "\": " << counters[c].load();
+   }
+   out << "\n   },\n   \"histograms\": {";
+   for (int h=0; h<HistogramCount; ++h) {
+      out << (h > 0 ? ",\n" : "\n") << "      \"" << histogramNames[h] << "\": {";
+      bool first = true;
+      for (int b=0; b<BucketCount; ++b) {
+         qint64 const samples = histograms[h][b].load();
+         if (samples > 0) {
+            out << (first ? "" : ", ") << "\"" << bucketName(b) << "\": " << samples;
+            first = false;
+         }
+      }
+      out << "}";
+   }
+
+   // the live bytes are those of the process, other images in flight included
+   out << "\n   },\n   \"memory\": [";
+   QMutexLocker locker(&mutex);
+   for (int s=0; s<memorySamples.size(); ++s) {
+      MemorySample const & snapshot = memorySamples.at(s);
+      out << (s > 0 ? ",\n" : "\n") << "      {\"stage\": \"" << snapshot.stage << "\",\n";
+      out << "       \"liveBytes\": {";
+      for (int m=0; m<=MemoryCount; ++m) {
+         out << (m > 0 ? ", " : "") << "\"" << memoryNames[m] << "\": " << snapshot.live[m];
+      }
+      out << "},\n       \"peakBytes\": {";
+      for (int m=0; m<=MemoryCount; ++m) {
+         out << (m > 0 ? ", " : "") << "\"" << memoryNames[m] << "\": " << snapshot.peak[m];
+      }
+      out << "},\n       \"residentBytes\": " << snapshot.resident
+          << ", \"peakResidentBytes\": " << snapshot.peakResident << "}";
+   }
+   out << "\n   ]\n}\n";
+   out.flush();
+   return file.error() == QFile::NoError;
+}
+
+void Stats::setCurrent(Stats * stats) {
+   currentStats = stats;
+}
+
+void Stats::track(Memory memory, qint64 & tracked, qint64 bytes) {
+   if (bytes != tracked) {
+      allocate(memory, bytes - tracked);
+      tracked = bytes;
+   }
+}
@@ -0,0 +1,133 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <QAtomicInteger>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+// algorithmic counters and memory use of one run, they are only collected if
+// TIDY_STATS is defined
+class Stats {
+
+public:
+   enum Counter {
+      MeanShiftPixels,
+      LatticeCellsVisited,
+      LatticePixelsCompared,
+      WatershedMarkers,
+      WatershedDams,
+      MergeRounds,
+      Merges,
+      BroadPhaseUpdates,
+      BroadPhaseRejections,
+      CollidesCalls,
+      Collisions,
+      CirclePasses,
+      ForceRefinements,
+      ForceIterations,
+      ForceBudgetsExhausted,
+      ResidualCollisions,
+      PackingFitTests,
+      CounterCount
+   };
+
+   enum Histogram {
+      MeanShiftIterations,
+      WatershedPlateauSize,
+      ForceIterationsPerRefinement,
+      HistogramCount
+   };
+
+   // the tracked heap, the live bytes are counted for the whole process
+   enum Memory {
+      ImageMemory,
+      WorkMemory,
+      SegmentMemory,
+      NeighbourMemory,
+      ShapeMemory,
+      MemoryCount
+   };
+
+   void count(Counter counter, qint64 n);
+   void enterStage(QString const & stage);
+   void leaveStage();
+   void sample(Histogram histogram, qint64 value);
+   bool save(QString const & filename) const;
+
+   static void allocate(Memory memory, qint64 bytes);
+   static Stats * current();
+   static void track(Memory memory, qint64 & tracked, qint64 bytes);
+
+private:
+   friend class StatsScope;
+
+   // the live and peak bytes of each kind of memory when a stage ended, the
+   // last entries are the sums
+   struct MemorySample {
+      QString stage;
+      qint64 live[MemoryCount+1];
+      qint64 peak[MemoryCount+1];
+      qint64 resident;
+      qint64 peakResident;
+   };
+
+   // exact values below 16, powers of two above
+   static int const BucketCount = 16 + 59;
+
+   QAtomicInteger<qint64> counters[CounterCount];
+   QAtomicInteger<qint64> histograms[HistogramCount][BucketCount];
+   // the most live bytes seen by the allocations of this run in the current stage
+   QAtomicInteger<qint64> stagePeaks[MemoryCount+1];
+   mutable QMutex mutex;
+   QString stage;
+   QList<MemorySample> memorySamples;
+
+   void closeStage();
+
+   static int bucket(qint64 value);
+   static QString bucketName(int bucket);
+   static void raise(QAtomicInteger<qint64> & peak, qint64 value);
+   static void setCurrent(Stats * stats);
+};
+
+// makes the stats of a run the current ones of this thread, the worker
+// threads a run spreads to need their own scope
+class StatsScope {
+
+public:
+   explicit StatsScope(Stats * stats) :
+      previous(Stats::current())
+   {
+      Stats::setCurrent(stats);
+   }
+
+   ~StatsScope() {
+      Stats::setCurrent(previous);
+   }
+
+   StatsScope(StatsScope const &) = delete;
+   StatsScope & operator=(StatsScope const &) = delete;
+
+private:
+   Stats * previous;
+};
+
+#ifdef TIDY_STATS
+#define TIDY_COUNT(counter, n) \
+   do { if (Stats * const stats_ = Stats::current()) stats_->count(Stats::counter, n); } while (false)
+#define TIDY_SAMPLE(histogram, value) \
+   do { if (Stats * const stats_ = Stats::current()) stats_->sample(Stats::histogram, value); } while (false)
+#define TIDY_STAGE(stage) \
+   do { if (Stats * const stats_ = Stats::current()) stats_->enterStage(stage); } while (false)
+#define TIDY_ALLOCATE(memory, bytes) Stats::allocate(Stats::memory, bytes)
+#define TIDY_RELEASE(memory, bytes) Stats::allocate(Stats::memory, -(bytes))
+#else
+#define TIDY_COUNT(counter, n) do {} while (false)
+#define TIDY_SAMPLE(histogram, value) do {} while (false)
+#define TIDY_STAGE(stage) do {} while (false)
+#define TIDY_ALLOCATE(memory, bytes) do {} while (false)
+#define TIDY_RELEASE(memory, bytes) do {} while (false)
+#endif
+
+#endif // STATS_H
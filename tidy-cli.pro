@@ -0,0 +1,11 @@
+# headless batch runner, needs no display
+TARGET = tidy-cli
+
+TEMPLATE = app
+
+include(tidy.pri)
+
+SOURCES += cli.cpp
+
+CONFIG += console
+CONFIG -= app_bundle
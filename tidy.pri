@@ -0,0 +1,70 @@
+# sources shared by the gui and the command line runner
+
+QT += core gui widgets concurrent
+
+SOURCES += color.cpp \
+           gray.cpp \
+           pixel.cpp \
+           segment.cpp \
+           decomposer.cpp \
+           meanshiftdecomposer.cpp \
+           watersheddecomposer.cpp \
+           arranger.cpp \
+           forcedirectedarranger.cpp \
+           clusteredarranger.cpp \
+           packingarranger.cpp \
+           featurevector.cpp \
+           segmentlist.cpp \
+           layoutstate.cpp \
+           compositor.cpp \
+           broadphase.cpp \
+           layoutintegrator.cpp \
+           distancefield.cpp \
+           pointgrid.cpp \
+           batchpipeline.cpp \
+           segmentcache.cpp \
+           artifactsink.cpp \
+           runcontrol.cpp \
+           stagecache.cpp \
+           stats.cpp \
+           trace.cpp
+
+HEADERS += color.h \
+           gray.h \
+           pixel.h \
+           image.forward.h \
+           image.h \
+           segment.h \
+           decomposer.h \
+           meanshiftdecomposer.h \
+           watersheddecomposer.h \
+           arranger.h \
+           forcedirectedarranger.h \
+           clusteredarranger.h \
+           packingarranger.h \
+           featurevector.h \
+           segmentlist.h \
+           layoutstate.h \
+           compositor.h \
+           broadphase.h \
+           layoutintegrator.h \
+           distancefield.h \
+           pointgrid.h \
+           boundedqueue.h \
+           batchpipeline.h \
+           segmentcache.h \
+           artifactsink.h \
+           runcontrol.h \
+           stagecache.h \
+           stats.h \
+           trace.h
+
+QMAKE_CXXFLAGS += -pedantic
+
+CONFIG += c++11
+
+# qmake CONFIG+=stats collects the algorithmic counters and the memory use of each
+# batch run into stats.json
+stats {
+   DEFINES += TIDY_STATS
+}
@@ -0,0 +1,91 @@
+#include "trace.h"
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+struct TraceEvent {
+   char const * name;
+   qint64 start;
+   qint64 end;
+};
+
+// every thread appends to its own buffer, the lock is only contended while saving
+struct TraceBuffer {
+   int thread;
+   QString threadName;
+   QMutex mutex;
+   QVector<TraceEvent> events;
+};
+
+static QMutex buffersMutex;
+static QList<TraceBuffer *> buffers;
+static thread_local TraceBuffer * threadBuffer = nullptr;
+
+static QElapsedTimer startedClock() {
+   QElapsedTimer clock;
+   clock.start();
+   return clock;
+}
+
+QAtomicInt Trace::enabled(0);
+QElapsedTimer const Trace::clock = startedClock();
+
+void Trace::clear() {
+   QMutexLocker locker(&buffersMutex);
+   foreach (TraceBuffer * const buffer, buffers) {
+      QMutexLocker bufferLocker(&buffer->mutex);
+      buffer->events.clear();
+   }
+}
+
+void Trace::record(char const * name, qint64 start) {
+   qint64 const end = now();
+   if (!threadBuffer) {
+      // the buffers outlive their threads, the pools reuse them anyway
+      QMutexLocker locker(&buffersMutex);
+      threadBuffer = new TraceBuffer();
+      threadBuffer->thread = buffers.size() + 1;
+      threadBuffer->threadName = QThread::currentThread()->objectName();
+      if (threadBuffer->threadName.isEmpty()) {
+         threadBuffer->threadName = "Thread";
+      }
+      buffers << threadBuffer;
+   }
+   QMutexLocker locker(&threadBuffer->mutex);
+   threadBuffer->events.append(TraceEvent{name, start, end});
+}
+
+bool Trace::save(QString const & filename) {
+   // chrome://tracing and Perfetto read complete events ("X") in microseconds,
+   // nesting follows from the times on each thread
+   QFile file(filename);
+   if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+      return false;
+   }
+   QTextStream out(&file);
+   out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+   bool first = true;
+   QMutexLocker locker(&buffersMutex);
+   foreach (TraceBuffer * const buffer, buffers) {
+      QMutexLocker bufferLocker(&buffer->mutex);
+      out << (first ? "\n" : ",\n");
+      first = false;
+      out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread
+          << ",\"args\":{\"name\":\"" << buffer->threadName << " " << buffer->thread << "\"}}";
+      foreach (TraceEvent const & event, buffer->events) {
+         out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread
+             << ",\"ts\":" << QString::number(event.start/1000.0, 'f', 3)
+             << ",\"dur\":" << QString::number((event.end-event.start)/1000.0, 'f', 3) << "}";
+      }
+   }
+   out << "\n]}\n";
+   out.flush();
+   return file.error() == QFile::NoError;
+}
+
+void Trace::setEnabled(bool enabled) {
+   Trace::enabled.store(enabled ? 1 : 0);
+}
@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QString>
+
+class Trace {
+
+public:
+   static void clear();
+   static bool save(QString const & filename);
+   static void setEnabled(bool enabled);
+
+   static bool isEnabled() {
+      return enabled.load() != 0;
+   }
+
+   static qint64 now() {
+      return clock.nsecsElapsed();
+   }
+
+   static void record(char const * name, qint64 start);
+
+private:
+   static QAtomicInt enabled;
+   static QElapsedTimer const clock;
+};
+
+// measures the scope it lives in, the name has to be a string literal
+class TraceSpan {
+
+public:
+   explicit TraceSpan(char const * name) :
+      name(name), start(Trace::isEnabled() ? Trace::now() : -1)
+   {
+   }
+
+   ~TraceSpan() {
+      if (start >= 0) {
+         Trace::record(name, start);
+      }
+   }
+
+   TraceSpan(TraceSpan const &) = delete;
+   TraceSpan & operator=(TraceSpan const &) = delete;
+
+private:
+   char const * name;
+   qint64 start;
+};
+
+#endif // TRACE_H
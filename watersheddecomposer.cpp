@@ -1,70 +1,115 @@
 #include "watersheddecomposer.h"
 #include <algorithm>
 #include <memory>
+#include <QDir>
 #include <QDoubleSpinBox>
 #include <QFormLayout>
 #include <QSpinBox>
-#include <QTime>
 #include "image.h"
 #include "pixel.h"
+#include "runcontrol.h"
 #include "segment.h"
 #include "segmentlist.h"
+#include "stats.h"
+#include "trace.h"
 
 WaterShedDecomposer::WaterShedDecomposer() :
    Decomposer("Watershed Decomposer")
 {
-   populateSettingsLayout();
 }
 
 SegmentList WaterShedDecomposer::decompose(ImageColor const & image) const {
-   QTime time;
-   time.start();
+   WaterShedParameters const params = parameters;
+   return decomposeTo(image, params, QString(), true);
+}
+
+SegmentList WaterShedDecomposer::decomposeBatch(ImageColor const & image, QString const & name) const {
+   TraceSpan const span("WaterShedDecomposer::decomposeBatch");
+   WaterShedParameters const params = parameters;
+   QDir dir;
+   dir.mkpath(name);
+   return decomposeTo(image, params, name + "/", true);
+}
+
+SegmentList WaterShedDecomposer::decomposeTo(ImageColor const & image, WaterShedParameters const & params,
+                                             QString const & prefix, bool debug) const {
+   TraceSpan const span("WaterShedDecomposer::decomposeTo");
 
    // original image
-   image.save("WS1_original.png");
+   bool const writeDebug = debug && debugArtifacts();
+   if (writeDebug) {
+      saveDebug(image, prefix + "WS1_original.png");
+   }
+
+   // earlier stages are reused while only the merge parameters change
+   QByteArray const key = StageCache::imageKey(image) + QString(";r=%1").arg(params.radiusGauss).toUtf8();
 
    // filter image
-   time.restart();
-   ImageColor filtered = filterGauss(image, radiusGauss->value());
-   qDebug("Image filtered in %g seconds", time.restart()/1000.0);
-   filtered.save("WS2_filtered.png");
+   ImageColor filtered;
+   if (!stageCache.find(key + ";gauss", filtered)) {
+      beginStage(QObject::tr("Blurring"), image.width() + image.height());
+      filtered = filterGauss(image, params.radiusGauss);
+      if (canceled()) {
+         return SegmentList();
+      }
+      stageCache.insert(key + ";gauss", filtered);
+   }
+   if (writeDebug) {
+      saveDebug(filtered, prefix + "WS2_filtered.png");
+   }
 
    // calculate gradient magnitude map
-   time.restart();
-   ImageGray gradientMap = gradientMagnitude(filtered);
-   qDebug("Gradient magnitude map calculated in %g seconds", time.restart()/1000.0);
-   gradientMap.save("WS3_gradient.png");
+   ImageGray gradientMap;
+   if (!stageCache.find(key + ";gradient", gradientMap)) {
+      beginStage(QObject::tr("Calculating gradients"));
+      gradientMap = gradientMagnitude(filtered);
+      stageCache.insert(key + ";gradient", gradientMap);
+   }
+   if (writeDebug) {
+      // scaled to the full range just for viewing, the transformation only needs the order
+      ImageGray scaled(gradientMap);
+      float max = 0.0;
+      for (int i=0; i<scaled.area(); ++i) {
+         max = std::max(max, scaled.at(i).l);
+      }
+      for (int i=0; i<scaled.area(); ++i) {
+         scaled.at(i).l *= 255.0/max;
+      }
+      saveDebug(scaled, prefix + "WS3_gradient.png");
+   }
 
    // apply watershed transformation
-   time.restart();
-   SegmentList segments = watershed(gradientMap, image);
-   qDebug("Watershed transformation applied in %g seconds", time.restart()/1000.0);
+   SegmentList segments;
+   if (!stageCache.find(key + ";watershed", segments)) {
+      beginStage(QObject::tr("Watershed transformation"), image.height());
+      segments = watershed(gradientMap, image);
+      if (canceled()) {
+         segments.deleteAndClear();
+         return segments;
+      }
+      stageCache.insert(key + ";watershed", segments);
+   }
    qDebug("  Segments: %d", segments.size());
-   ImageColor debugOut(image.width(), image.height());
-   segments.copyToImageAVG(debugOut);
-   debugOut.save("WS4_transformed.png");
+   ImageColor debugOut;
+   if (writeDebug) {
+      debugOut = ImageColor(image.width(), image.height());
+      segments.copyToImageAVG(debugOut);
+      saveDebug(debugOut, prefix + "WS4_transformed.png");
+   }
 
    // merge similiar and small segments
-   time.restart();
-   int oldSegmentsSize;
-   do {
-      oldSegmentsSize = segments.size();
-      mergeSimiliarSegments(segments, epsilonMerge->value()*epsilonMerge->value());
-      mergeSmallSegments(segments, minSize->value());
-   } while (segments.size() != oldSegmentsSize);
-   qDebug("Segments merged in %g seconds", time.restart()/1000.0);
+   mergeSegments(segments, params.epsilonMerge, params.minSize);
    qDebug("  Segments: %d", segments.size());
-   segments.copyToImageAVG(debugOut);
-   debugOut.save("WS5_merged.png");
+   if (writeDebug) {
+      segments.copyToImageAVG(debugOut);
+      saveDebug(debugOut, prefix + "WS5_merged.png");
+   }
 
    return segments;
 }
 
-SegmentList WaterShedDecomposer::decomposeBatch(ImageColor const & image, QString const &) const {
-   return decompose(image);
-}
-
 ImageColor WaterShedDecomposer::filterGauss(ImageColor const & image, int r) const {
+   TraceSpan const span("WaterShedDecomposer::filterGauss");
    return filterGaussSinglePass(filterGaussSinglePass(image, r), r);
 }
 
@@ -80,7 +125,8 @@ ImageColor WaterShedDecomposer::filterGaussSinglePass(ImageColor const & image,
    kernel[r] = nCr(n-1, r);
 
    ImageColor filtered(image.height(), image.width());
-   for (int y=0; y<image.height(); ++y) {
+   for (int y=0; y<image.height() && !canceled(); ++y) {
+      advance();
       for (int x=0; x<image.width(); ++x) {
          Color color;
          unsigned long long weights = 0;
@@ -100,6 +146,7 @@ ImageColor WaterShedDecomposer::filterGaussSinglePass(ImageColor const & image,
 }
 
 ImageGray WaterShedDecomposer::gradientMagnitude(ImageColor const & image) const {
+   TraceSpan const span("WaterShedDecomposer::gradientMagnitude");
    ImageGray gmImage(image.width(), image.height());
 
    // Frobenius norm on Jacobian matrix
@@ -112,15 +159,6 @@ ImageGray WaterShedDecomposer::gradientMagnitude(ImageColor const & image) const
       }
    }
 
-   // scaling just for debug
-   float max = 0.0;
-   for (int i=0; i<gmImage.area(); ++i) {
-      max = std::max(max, gmImage.at(i).l);
-   }
-   for (int i=0; i<gmImage.area(); ++i) {
-      gmImage.at(i).l *= 255.0/max;
-   }
-
    return gmImage;
 }
 
@@ -142,29 +180,73 @@ unsigned long long WaterShedDecomposer::nCr(int n, int r) const {
    }
 }
 
+QString WaterShedDecomposer::parameterKey() const {
+   return QString("radiusGauss=%1;minSize=%2;epsilonMerge=%3")
+         .arg(parameters.radiusGauss).arg(parameters.minSize).arg(parameters.epsilonMerge);
+}
+
 void WaterShedDecomposer::populateSettingsLayout() {
-   radiusGauss = new QSpinBox();
-   radiusGauss->setRange(1, 31);
-   radiusGauss->setValue(31);
-   radiusGauss->setToolTip(QObject::tr("Kernel radius of the Gaussian blur filter"));
-   settingsLayout->addRow(QObject::tr("Gauß kernel radius"), radiusGauss);
-
-   minSize = new QSpinBox();
-   minSize->setRange(1, 1000);
-   minSize->setValue(50);
-   minSize->setToolTip(QObject::tr("The minimal allowed segment size (smaller segments will be merged)"));
-   settingsLayout->addRow(QObject::tr("Minimum size"), minSize);
-
-   epsilonMerge = new QDoubleSpinBox();
-   epsilonMerge->setRange(0.5, 50.0);
-   epsilonMerge->setValue(3.0);
-   epsilonMerge->setSingleStep(0.1);
-   epsilonMerge->setToolTip(QObject::tr("The minimum color space distance (nearer segments will be merged)"));
-   settingsLayout->addRow(QChar(949)+QObject::tr(" merge"), epsilonMerge);
+   QSpinBox * radiusGaussBox = new QSpinBox();
+   radiusGaussBox->setRange(1, 31);
+   radiusGaussBox->setValue(parameters.radiusGauss);
+   radiusGaussBox->setToolTip(QObject::tr("Kernel radius of the Gaussian blur filter"));
+   QObject::connect(radiusGaussBox, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+                    [this](int value) { parameters.radiusGauss = value; parametersChanged(); });
+   settingsLayout->addRow(QObject::tr("Gauß kernel radius"), radiusGaussBox);
+
+   QSpinBox * minSizeBox = new QSpinBox();
+   minSizeBox->setRange(1, 1000);
+   minSizeBox->setValue(parameters.minSize);
+   minSizeBox->setToolTip(QObject::tr("The minimal allowed segment size (smaller segments will be merged)"));
+   QObject::connect(minSizeBox, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+                    [this](int value) { parameters.minSize = value; parametersChanged(); });
+   settingsLayout->addRow(QObject::tr("Minimum size"), minSizeBox);
+
+   QDoubleSpinBox * epsilonMergeBox = new QDoubleSpinBox();
+   epsilonMergeBox->setRange(0.5, 50.0);
+   epsilonMergeBox->setValue(parameters.epsilonMerge);
+   epsilonMergeBox->setSingleStep(0.1);
+   epsilonMergeBox->setToolTip(QObject::tr("The minimum color space distance (nearer segments will be merged)"));
+   QObject::connect(epsilonMergeBox, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+                    [this](double value) { parameters.epsilonMerge = value; parametersChanged(); });
+   settingsLayout->addRow(QChar(949)+QObject::tr(" merge"), epsilonMergeBox);
+}
+
+std::function<SegmentList()> WaterShedDecomposer::previewTask(ImageColor const & image, double scale) const {
+   // the spatial parameters shrink with the image, no debug images are written
+   WaterShedParameters params = parameters;
+   params.radiusGauss = std::max(1, qRound(params.radiusGauss*scale));
+   params.minSize = std::max(1, qRound(params.minSize*scale*scale));
+   return [this, &image, params]() {
+      return decomposeTo(image, params, QString(), false);
+   };
+}
+
+bool WaterShedDecomposer::setParameter(QString const & key, QString const & value) {
+   // same ranges as the settings widgets
+   bool ok;
+   double const number = value.toDouble(&ok);
+   if (!ok) {
+      return false;
+   }
+   if (key == "radiusGauss") {
+      parameters.radiusGauss = qBound(1, qRound(number), 31);
+   }
+   else if (key == "minSize") {
+      parameters.minSize = qBound(1, qRound(number), 1000);
+   }
+   else if (key == "epsilonMerge") {
+      parameters.epsilonMerge = qBound(0.5, number, 50.0);
+   }
+   else {
+      return false;
+   }
+   return true;
 }
 
 SegmentList WaterShedDecomposer::watershed(ImageGray const & gradient,
                                            ImageColor const & image) const {
+   TraceSpan const span("WaterShedDecomposer::watershed");
    SegmentList segments;
    std::unique_ptr<int[]> labels(new int[image.area()]);
    for (int i=0; i<image.area(); ++i) labels[i] = -1;
@@ -176,6 +258,20 @@ SegmentList WaterShedDecomposer::watershed(ImageGray const & gradient,
       queue << GradPixelRef{gradient.at(i).l, i};
    }
    std::sort(queue.begin(), queue.end(), lessThan);
+#ifdef TIDY_STATS
+   // the labels and the queue, whose items are nodes of their own
+   qint64 const workBytes = qint64(image.area())*sizeof(int) +
+                            qint64(queue.size())*(sizeof(GradPixelRef) + sizeof(void *) + 16);
+   TIDY_ALLOCATE(WorkMemory, workBytes);
+
+   // pixels of the same level are flooded in an arbitrary order, long runs of them
+   // (the plateaus) make the result depend on the scan order
+   for (int begin=0, end; begin<queue.size(); begin=end) {
+      for (end=begin+1; end<queue.size() &&
+           queue.at(end).gradientMagnitude == queue.at(begin).gradientMagnitude; ++end) {}
+      TIDY_SAMPLE(WatershedPlateauSize, end-begin);
+   }
+#endif
 
    int label;
    int lastLabel = -1;
@@ -183,7 +279,15 @@ SegmentList WaterShedDecomposer::watershed(ImageGray const & gradient,
    QList<int> neighLbls;
    Pixel * pixel;
    Segment * segment;
+   int flooded = 0;
    foreach (GradPixelRef const & gradPix, queue) {
+      // progress and cancellation once per image row
+      if (++flooded % image.width() == 0) {
+         if (canceled()) {
+            break;
+         }
+         advance();
+      }
       i = gradPix.index;
       pixel = new Pixel(Position(i%image.width(), i/image.width()), image.at(i));
 
@@ -199,6 +303,7 @@ SegmentList WaterShedDecomposer::watershed(ImageGray const & gradient,
       // treat pixel according to neighbour count
       switch (neighLbls.size()) {
       case 0: // new marker
+         TIDY_COUNT(WatershedMarkers, 1);
          labels[i] = ++lastLabel;
          segment = new Segment();
          segment->addPixel(pixel);
@@ -210,6 +315,7 @@ SegmentList WaterShedDecomposer::watershed(ImageGray const & gradient,
          segments.at(label)->addPixel(pixel);
          break;
       default: // new watershed
+         TIDY_COUNT(WatershedDams, 1);
          // add pixel the segment of the nearest neighbour in color
          double distMin = std::numeric_limits<double>::max();
          double dist;
@@ -239,5 +345,8 @@ SegmentList WaterShedDecomposer::watershed(ImageGray const & gradient,
    }
 
    segments.calculateMeanColors();
+#ifdef TIDY_STATS
+   TIDY_RELEASE(WorkMemory, workBytes);
+#endif
    return segments;
 }
@@ -3,22 +3,28 @@
 
 #include "decomposer.h"
 
-class QSpinBox;
-class QDoubleSpinBox;
+struct WaterShedParameters {
+   int radiusGauss = 31;
+   int minSize = 50;
+   double epsilonMerge = 3.0;
+};
 
 class WaterShedDecomposer : public Decomposer {
 
 public:
    WaterShedDecomposer();
    virtual SegmentList decompose(ImageColor const & image) const;
-   virtual SegmentList decomposeBatch(ImageColor const & image, QString const &) const;
+   virtual SegmentList decomposeBatch(ImageColor const & image, QString const & name) const;
+   virtual std::function<SegmentList()> previewTask(ImageColor const & image, double scale) const;
+   virtual bool setParameter(QString const & key, QString const & value);
+   virtual QString parameterKey() const;
 
 protected:
-   QSpinBox * radiusGauss;
-   QSpinBox * minSize;
-   QDoubleSpinBox * epsilonMerge;
+   WaterShedParameters parameters;
 
-   void populateSettingsLayout();
+   virtual void populateSettingsLayout();
+   SegmentList decomposeTo(ImageColor const & image, WaterShedParameters const & params,
+                           QString const & prefix, bool debug) const;
 
    ImageGray gradientMagnitude(ImageColor const & image) const;
    SegmentList watershed(ImageGray const & gradient,